@@ -0,0 +1,265 @@
+#include "bitbase.h"
+
+namespace
+{
+// the pawn is white and on files a to d, so it's on one of 24 squares
+constexpr size_t kpkPawnSquareCount = 4 * (BoardSize - 2);
+constexpr size_t kpkPositionCount = kpkPawnSquareCount * BoardSize * BoardSize * BoardSize * BoardSize * 2;
+
+int getX(int square)
+{
+    return square % (int)BoardSize;
+}
+
+int getY(int square)
+{
+    return square / (int)BoardSize;
+}
+
+int getKingDistance(int a, int b)
+{
+    return max(abs(getX(a) - getX(b)), abs(getY(a) - getY(b)));
+}
+
+bool isAttackedByPawn(int square, int pawn)
+{
+    return getY(square) == getY(pawn) + 1 && abs(getX(square) - getX(pawn)) == 1;
+}
+
+size_t getKPKIndex(bool whiteToMove, int whiteKing, int blackKing, int pawn)
+{
+    const size_t pawnIndex = (size_t)(getY(pawn) - 1) * 4 + (size_t)getX(pawn);
+    return ((pawnIndex * BoardSize * BoardSize + (size_t)whiteKing) * BoardSize * BoardSize + (size_t)blackKing) * 2 + (whiteToMove ? 0 : 1);
+}
+
+template <typename Fn>
+void forEachKingMove(int king, Fn fn)
+{
+    for(int dx = -1; dx <= 1; dx++)
+    {
+        for(int dy = -1; dy <= 1; dy++)
+        {
+            const int x = getX(king) + dx, y = getY(king) + dy;
+            if((dx != 0 || dy != 0) && x >= 0 && y >= 0 && x < (int)BoardSize && y < (int)BoardSize)
+                fn((int)getSquareIndex((size_t)x, (size_t)y));
+        }
+    }
+}
+
+class KPKBitbase final
+{
+    enum Result : uint8_t
+    {
+        Invalid,
+        Unknown,
+        Draw,
+        Win
+    };
+    struct Position final
+    {
+        bool whiteToMove;
+        int whiteKing, blackKing, pawn;
+    };
+    uint32_t wins[kpkPositionCount / 32];
+    static Result getInitialResult(const Position &p);
+    static Result classify(const Position &p, const vector<Result> &results);
+public:
+    KPKBitbase();
+    bool isWin(size_t index) const
+    {
+        return (wins[index / 32] >> (index % 32)) & 1;
+    }
+};
+
+// the positions decided without looking at the moves: promotions that can't be stopped and pawns that get taken
+KPKBitbase::Result KPKBitbase::getInitialResult(const Position &p)
+{
+    if(p.whiteKing == p.blackKing || p.whiteKing == p.pawn || p.blackKing == p.pawn || getKingDistance(p.whiteKing, p.blackKing) <= 1)
+        return Invalid;
+    if(p.whiteToMove)
+    {
+        if(isAttackedByPawn(p.blackKing, p.pawn))
+            return Invalid;
+        const int promotion = p.pawn + (int)BoardSize;
+        if(getY(p.pawn) == (int)BoardSize - 2 && p.whiteKing != promotion && p.blackKing != promotion
+           && (getKingDistance(p.blackKing, promotion) > 1 || getKingDistance(p.whiteKing, promotion) == 1))
+            return Win;
+        return Unknown;
+    }
+    bool canMove = false;
+    bool canTakePawn = false;
+    forEachKingMove(p.blackKing, [&](int square)
+    {
+        if(getKingDistance(square, p.whiteKing) <= 1 || isAttackedByPawn(square, p.pawn))
+            return;
+        canMove = true;
+        if(square == p.pawn)
+            canTakePawn = true;
+    });
+    if(canTakePawn)
+        return Draw;
+    if(!canMove)
+        return isAttackedByPawn(p.blackKing, p.pawn) ? Win : Draw;
+    return Unknown;
+}
+
+// white wins if any move wins, black draws if any move draws
+KPKBitbase::Result KPKBitbase::classify(const Position &p, const vector<Result> &results)
+{
+    bool anyWin = false, anyDraw = false, anyUnknown = false;
+    auto addChild = [&](size_t index)
+    {
+        switch(results[index])
+        {
+        case Win:
+            anyWin = true;
+            break;
+        case Draw:
+            anyDraw = true;
+            break;
+        default:
+            anyUnknown = true;
+            break;
+        }
+    };
+    if(p.whiteToMove)
+    {
+        forEachKingMove(p.whiteKing, [&](int square)
+        {
+            if(square != p.pawn && getKingDistance(square, p.blackKing) > 1)
+                addChild(getKPKIndex(false, square, p.blackKing, p.pawn));
+        });
+        const int push = p.pawn + (int)BoardSize;
+        if(getY(p.pawn) < (int)BoardSize - 2 && push != p.whiteKing && push != p.blackKing)
+        {
+            addChild(getKPKIndex(false, p.whiteKing, p.blackKing, push));
+            const int doublePush = push + (int)BoardSize;
+            if(getY(p.pawn) == 1 && doublePush != p.whiteKing && doublePush != p.blackKing)
+                addChild(getKPKIndex(false, p.whiteKing, p.blackKing, doublePush));
+        }
+        if(anyWin)
+            return Win;
+        return anyUnknown ? Unknown : Draw;
+    }
+    forEachKingMove(p.blackKing, [&](int square)
+    {
+        if(getKingDistance(square, p.whiteKing) > 1 && !isAttackedByPawn(square, p.pawn))
+            addChild(getKPKIndex(true, p.whiteKing, square, p.pawn));
+    });
+    if(anyDraw)
+        return Draw;
+    return anyUnknown ? Unknown : Win;
+}
+
+KPKBitbase::KPKBitbase()
+{
+    vector<Position> positions(kpkPositionCount);
+    vector<Result> results(kpkPositionCount);
+    for(int pawnY = 1; pawnY < (int)BoardSize - 1; pawnY++)
+    {
+        for(int pawnX = 0; pawnX < 4; pawnX++)
+        {
+            const int pawn = (int)getSquareIndex((size_t)pawnX, (size_t)pawnY);
+            for(int whiteKing = 0; whiteKing < (int)(BoardSize * BoardSize); whiteKing++)
+            {
+                for(int blackKing = 0; blackKing < (int)(BoardSize * BoardSize); blackKing++)
+                {
+                    for(bool whiteToMove : {true, false})
+                    {
+                        const size_t index = getKPKIndex(whiteToMove, whiteKing, blackKing, pawn);
+                        positions[index] = Position{whiteToMove, whiteKing, blackKing, pawn};
+                        results[index] = getInitialResult(positions[index]);
+                    }
+                }
+            }
+        }
+    }
+    vector<uint32_t> unknown;
+    for(size_t index = 0; index < kpkPositionCount; index++)
+    {
+        if(results[index] == Unknown)
+            unknown.push_back((uint32_t)index);
+    }
+    for(size_t lastCount = 0; unknown.size() != lastCount;)
+    {
+        lastCount = unknown.size();
+        size_t keptCount = 0;
+        for(uint32_t index : unknown)
+        {
+            results[index] = classify(positions[index], results);
+            if(results[index] == Unknown)
+                unknown[keptCount++] = index;
+        }
+        unknown.resize(keptCount);
+    }
+    // whatever is still unknown can't be forced to a win
+    for(uint32_t &word : wins)
+        word = 0;
+    for(size_t index = 0; index < kpkPositionCount; index++)
+    {
+        if(results[index] == Win)
+            wins[index / 32] |= (uint32_t)1 << (index % 32);
+    }
+}
+
+const KPKBitbase kpkBitbase;
+}
+
+bool probeKPK(const GameState &gs, bool &pawnSideWins)
+{
+    int whiteKing = -1, blackKing = -1, pawn = -1;
+    PieceColor pawnColor = PieceColor::White;
+    for(size_t x = 0; x < BoardSize; x++)
+    {
+        for(size_t y = 0; y < BoardSize; y++)
+        {
+            const int square = (int)getSquareIndex(x, y);
+            switch(gs.board[x][y])
+            {
+            case PieceType::Empty:
+                break;
+            case PieceType::WhiteKing:
+                whiteKing = square;
+                break;
+            case PieceType::BlackKing:
+                blackKing = square;
+                break;
+            case PieceType::WhitePawn:
+            case PieceType::BlackPawn:
+                if(pawn != -1)
+                    return false;
+                pawn = square;
+                pawnColor = getPieceColor(gs.board[x][y]);
+                break;
+            default:
+                return false;
+            }
+        }
+    }
+    if(pawn == -1 || whiteKing == -1 || blackKing == -1)
+        return false;
+    // seen from the pawn's side, with the pawn going up the board on the queen side
+    int strongKing = whiteKing, weakKing = blackKing;
+    if(pawnColor == PieceColor::Black)
+    {
+        auto flip = [](int square)
+        {
+            return (int)getSquareIndex((size_t)getX(square), BoardSize - 1 - (size_t)getY(square));
+        };
+        strongKing = flip(blackKing);
+        weakKing = flip(whiteKing);
+        pawn = flip(pawn);
+    }
+    if(getX(pawn) >= 4)
+    {
+        auto mirror = [](int square)
+        {
+            return (int)getSquareIndex(BoardSize - 1 - (size_t)getX(square), (size_t)getY(square));
+        };
+        strongKing = mirror(strongKing);
+        weakKing = mirror(weakKing);
+        pawn = mirror(pawn);
+    }
+    pawnSideWins = kpkBitbase.isWin(getKPKIndex(getPieceColor(gs.player) == pawnColor, strongKing, weakKing, pawn));
+    return true;
+}
@@ -0,0 +1,10 @@
+#ifndef BITBASE_H_INCLUDED
+#define BITBASE_H_INCLUDED
+
+#include "game_state.h"
+
+// exact results for king and pawn against king, generated when the program starts;
+// returns false if gs has other material, otherwise sets pawnSideWins (underpromotions aren't considered)
+bool probeKPK(const GameState &gs, bool &pawnSideWins);
+
+#endif // BITBASE_H_INCLUDED
@@ -0,0 +1,631 @@
+#include "book_builder.h"
+#include "opening_book.h"
+#include <fstream>
+#include <condition_variable>
+#include <queue>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+// the white piece a san letter stands for
+PieceType getSanPieceType(char letter)
+{
+    switch(letter)
+    {
+    case 'N':
+        return PieceType::WhiteKnight;
+    case 'B':
+        return PieceType::WhiteBishop;
+    case 'R':
+        return PieceType::WhiteRook;
+    case 'Q':
+        return PieceType::WhiteQueen;
+    case 'K':
+        return PieceType::WhiteKing;
+    default:
+        return PieceType::Empty;
+    }
+}
+
+struct BookRecord final
+{
+    uint64_t key;
+    uint16_t move;
+    uint32_t wins, draws, losses; // of the player making the move
+    friend bool operator <(const BookRecord &l, const BookRecord &r)
+    {
+        return tie(l.key, l.move) < tie(r.key, r.move);
+    }
+    bool isSameMove(const BookRecord &r) const
+    {
+        return key == r.key && move == r.move;
+    }
+    void add(const BookRecord &r)
+    {
+        wins += r.wins;
+        draws += r.draws;
+        losses += r.losses;
+    }
+};
+
+// sorts and adds up the records of the same move
+void compactRecords(vector<BookRecord> &records)
+{
+    sort(records.begin(), records.end());
+    size_t keptCount = 0;
+    for(const BookRecord &record : records)
+    {
+        if(keptCount > 0 && records[keptCount - 1].isSameMove(record))
+            records[keptCount - 1].add(record);
+        else
+            records[keptCount++] = record;
+    }
+    records.resize(keptCount);
+}
+
+// sorted runs of records on disk, removed once merged or when done
+class RunFiles final
+{
+    string baseName;
+    mutex lock;
+    size_t createdCount = 0;
+    vector<string> fileNames;
+public:
+    explicit RunFiles(const string &baseName)
+        : baseName(baseName)
+    {
+    }
+    RunFiles(const RunFiles &) = delete;
+    const RunFiles & operator =(const RunFiles &) = delete;
+    ~RunFiles()
+    {
+        for(const string &fileName : fileNames)
+            remove(fileName.c_str());
+    }
+    string add()
+    {
+        lock_guard<mutex> lockIt(lock);
+        fileNames.push_back(baseName + ".run" + to_string(createdCount++));
+        return fileNames.back();
+    }
+    void write(const vector<BookRecord> &records)
+    {
+        const string fileName = add();
+        ofstream os(fileName, ios::binary);
+        os.write((const char *)records.data(), records.size() * sizeof(BookRecord));
+        os.close();
+        if(!os)
+            throw FileError("can't write " + fileName);
+    }
+    void removeMerged(const vector<string> &mergedFileNames)
+    {
+        lock_guard<mutex> lockIt(lock);
+        for(const string &fileName : mergedFileNames)
+        {
+            remove(fileName.c_str());
+            fileNames.erase(find(fileNames.begin(), fileNames.end(), fileName));
+        }
+    }
+    const vector<string> & getFileNames() const
+    {
+        return fileNames;
+    }
+};
+
+class RunReader final
+{
+    ifstream is;
+    vector<BookRecord> buffer;
+    size_t bufferSize;
+    size_t position = 0;
+public:
+    RunReader(const string &fileName, size_t bufferSize)
+        : is(fileName, ios::binary), bufferSize(bufferSize)
+    {
+        if(!is)
+            throw FileError("can't open " + fileName);
+    }
+    bool read(BookRecord &record)
+    {
+        if(position == buffer.size())
+        {
+            buffer.resize(bufferSize);
+            is.read((char *)buffer.data(), bufferSize * sizeof(BookRecord));
+            buffer.resize((size_t)is.gcount() / sizeof(BookRecord));
+            position = 0;
+            if(buffer.empty())
+                return false;
+        }
+        record = buffer[position++];
+        return true;
+    }
+};
+
+// merges sorted runs, calling output in order once per move with its records added up
+template <typename Fn>
+void mergeRuns(const vector<string> &fileNames, size_t bufferSize, Fn output)
+{
+    vector<unique_ptr<RunReader>> readers;
+    typedef pair<BookRecord, size_t> QueueEntry;
+    auto isLater = [](const QueueEntry &l, const QueueEntry &r)
+    {
+        return r.first < l.first;
+    };
+    priority_queue<QueueEntry, vector<QueueEntry>, decltype(isLater)> mergeQueue(isLater);
+    for(const string &fileName : fileNames)
+    {
+        readers.push_back(unique_ptr<RunReader>(new RunReader(fileName, bufferSize)));
+        BookRecord record;
+        if(readers.back()->read(record))
+            mergeQueue.push(make_pair(record, readers.size() - 1));
+    }
+    BookRecord merged;
+    bool haveMerged = false;
+    while(!mergeQueue.empty())
+    {
+        QueueEntry entry = mergeQueue.top();
+        mergeQueue.pop();
+        BookRecord next;
+        if(readers[entry.second]->read(next))
+            mergeQueue.push(make_pair(next, entry.second));
+        if(haveMerged && merged.isSameMove(entry.first))
+        {
+            merged.add(entry.first);
+            continue;
+        }
+        if(haveMerged)
+            output(merged);
+        merged = entry.first;
+        haveMerged = true;
+    }
+    if(haveMerged)
+        output(merged);
+}
+
+// batches of game texts from the reading thread to the parsing threads; bounded so a big file isn't read ahead
+class GameQueue final
+{
+    mutex lock;
+    condition_variable changed;
+    deque<vector<string>> batches;
+    size_t maxBatchCount;
+    bool finished = false;
+public:
+    explicit GameQueue(size_t maxBatchCount)
+        : maxBatchCount(maxBatchCount)
+    {
+    }
+    void push(vector<string> &&batch)
+    {
+        unique_lock<mutex> lockIt(lock);
+        changed.wait(lockIt, [this]()
+        {
+            return batches.size() < maxBatchCount || finished;
+        });
+        if(finished)
+            return;
+        batches.push_back(move(batch));
+        changed.notify_all();
+    }
+    bool pop(vector<string> &batch)
+    {
+        unique_lock<mutex> lockIt(lock);
+        changed.wait(lockIt, [this]()
+        {
+            return !batches.empty() || finished;
+        });
+        if(batches.empty())
+            return false;
+        batch = move(batches.front());
+        batches.pop_front();
+        changed.notify_all();
+        return true;
+    }
+    void finish() // also wakes a reader waiting for room after a parsing thread failed
+    {
+        lock_guard<mutex> lockIt(lock);
+        finished = true;
+        changed.notify_all();
+    }
+};
+
+enum class GameResult
+{
+    WhiteWins,
+    Draw,
+    BlackWins,
+    Unknown
+};
+
+GameResult parseGameResult(const string &text)
+{
+    if(text == "1-0")
+        return GameResult::WhiteWins;
+    if(text == "0-1")
+        return GameResult::BlackWins;
+    if(text == "1/2-1/2")
+        return GameResult::Draw;
+    return GameResult::Unknown;
+}
+
+// adds a record for each of the first maxPly moves of a game; returns false if the game can't be used
+bool parseGame(const string &text, size_t maxPly, vector<BookRecord> &records)
+{
+    struct Ply final
+    {
+        uint64_t key;
+        uint16_t move;
+        Player player;
+    };
+    vector<Ply> plies;
+    GameResult tagResult = GameResult::Unknown, movetextResult = GameResult::Unknown;
+    GameState gs = GameState::makeInitialGameState();
+    bool movesEnded = false;
+    for(size_t i = 0; i < text.size();)
+    {
+        const char ch = text[i];
+        if(ch == '[' && (i == 0 || text[i - 1] == '\n'))
+        {
+            // a tag like [Result "1-0"]
+            size_t end = text.find('\n', i);
+            if(end == string::npos)
+                end = text.size();
+            const string tag = text.substr(i + 1, end - i - 1);
+            i = end;
+            const size_t nameEnd = tag.find(' ');
+            const size_t valueBegin = tag.find('"');
+            const size_t valueEnd = tag.rfind('"');
+            if(nameEnd == string::npos || valueBegin == string::npos || valueEnd <= valueBegin)
+                continue;
+            const string name = tag.substr(0, nameEnd), value = tag.substr(valueBegin + 1, valueEnd - valueBegin - 1);
+            if(name == "FEN" || (name == "Variant" && value != "Standard" && value != "standard"))
+                return false;
+            if(name == "Result")
+                tagResult = parseGameResult(value);
+        }
+        else if(isspace((unsigned char)ch))
+            i++;
+        else if(ch == '{')
+        {
+            const size_t end = text.find('}', i);
+            i = (end == string::npos ? text.size() : end + 1);
+        }
+        else if(ch == ';')
+        {
+            const size_t end = text.find('\n', i);
+            i = (end == string::npos ? text.size() : end + 1);
+        }
+        else if(ch == '(')
+        {
+            // variations, which can nest
+            size_t depth = 0;
+            for(; i < text.size(); i++)
+            {
+                if(text[i] == '(')
+                    depth++;
+                else if(text[i] == ')' && --depth == 0)
+                    break;
+                else if(text[i] == '{')
+                {
+                    const size_t end = text.find('}', i);
+                    i = (end == string::npos ? text.size() - 1 : end);
+                }
+            }
+            i++;
+        }
+        else
+        {
+            size_t end = i;
+            while(end < text.size() && !isspace((unsigned char)text[end]) && !strchr("{}();", text[end]))
+                end++;
+            string token = text.substr(i, end - i);
+            i = max(end, i + 1);
+            // move numbers like "12." or "12..." can be stuck to the move
+            size_t moveBegin = 0;
+            while(moveBegin < token.size() && isdigit((unsigned char)token[moveBegin]))
+                moveBegin++;
+            if(moveBegin < token.size() && token[moveBegin] == '.')
+            {
+                while(moveBegin < token.size() && token[moveBegin] == '.')
+                    moveBegin++;
+                token = token.substr(moveBegin);
+            }
+            if(token.empty() || token[0] == '$')
+                continue;
+            if(parseGameResult(token) != GameResult::Unknown || token == "*")
+            {
+                movetextResult = parseGameResult(token);
+                break;
+            }
+            if(movesEnded)
+                continue;
+            GameStateMove m;
+            if(plies.size() >= maxPly || !findSanMove(gs, token, m))
+            {
+                // past the book or a broken game; only the result is still needed
+                movesEnded = true;
+                if(tagResult != GameResult::Unknown)
+                    break;
+                continue;
+            }
+            plies.push_back(Ply{getPolyglotKey(gs), getPolyglotMove(gs, m), gs.player});
+            gs = m.apply(gs);
+        }
+    }
+    const GameResult result = (tagResult != GameResult::Unknown ? tagResult : movetextResult);
+    if(result == GameResult::Unknown)
+        return false;
+    for(const Ply &ply : plies)
+    {
+        BookRecord record = {ply.key, ply.move, 0, 0, 0};
+        if(result == GameResult::Draw)
+            record.draws = 1;
+        else if((result == GameResult::WhiteWins) == (ply.player == Player::White))
+            record.wins = 1;
+        else
+            record.losses = 1;
+        records.push_back(record);
+    }
+    return true;
+}
+
+void writeBigEndian(ostream &os, uint64_t value, size_t byteCount)
+{
+    for(size_t i = 0; i < byteCount; i++)
+        os.put((char)(uint8_t)(value >> (8 * (byteCount - 1 - i))));
+}
+
+// writes the entries for the moves of one position, best first
+size_t writePosition(ostream &os, const vector<BookRecord> &moves, uint32_t minGameCount)
+{
+    vector<pair<uint64_t, uint16_t>> weights;
+    uint64_t maxWeight = 0;
+    for(const BookRecord &record : moves)
+    {
+        if((uint64_t)record.wins + record.draws + record.losses < minGameCount)
+            continue;
+        const uint64_t weight = 2 * (uint64_t)record.wins + record.draws;
+        if(weight == 0)
+            continue;
+        weights.push_back(make_pair(weight, record.move));
+        maxWeight = max(maxWeight, weight);
+    }
+    const uint64_t maxEntryWeight = UINT16_MAX;
+    sort(weights.begin(), weights.end(), greater<pair<uint64_t, uint16_t>>());
+    for(const auto &weight : weights)
+    {
+        writeBigEndian(os, moves.front().key, 8);
+        writeBigEndian(os, weight.second, 2);
+        writeBigEndian(os, maxWeight > maxEntryWeight ? max<uint64_t>(1, weight.first * maxEntryWeight / maxWeight) : weight.first, 2);
+        writeBigEndian(os, 0, 4);
+    }
+    return weights.size();
+}
+}
+
+bool findSanMove(const GameState &gs, const string &san, GameStateMove &result)
+{
+    string text = san;
+    while(!text.empty() && strchr("+#!?", text.back()))
+        text.pop_back();
+    GameStateCache::MovesList moves;
+    GameStateCache::generatePseudoLegalMoves(gs, moves);
+    const PieceType king = setPieceColor(PieceType::WhiteKing, gs.player);
+    if(text == "O-O" || text == "0-0" || text == "O-O-O" || text == "0-0-0")
+    {
+        const int kingStep = (text.size() == 3 ? 2 : -2);
+        for(GameStateMove m : moves)
+        {
+            if(gs.board[m.startX][m.startY] == king && (int)m.endX - (int)m.startX == kingStep && !m.apply(gs).isKingAttacked(gs.player))
+            {
+                result = m;
+                return true;
+            }
+        }
+        return false;
+    }
+    PieceType piece = PieceType::WhitePawn;
+    size_t begin = 0, end = text.size();
+    if(end > 0 && getSanPieceType(text[0]) != PieceType::Empty)
+    {
+        piece = getSanPieceType(text[0]);
+        begin = 1;
+    }
+    PieceType promotion = PieceType::Empty;
+    if(end > begin && getSanPieceType(text[end - 1]) != PieceType::Empty)
+    {
+        promotion = setPieceColor(getSanPieceType(text[end - 1]), gs.player);
+        end--;
+        if(end > begin && text[end - 1] == '=')
+            end--;
+    }
+    if(end < begin + 2)
+        return false;
+    const int endX = text[end - 2] - 'a', endY = text[end - 1] - '1';
+    if(endX < 0 || endY < 0 || endX >= (int)BoardSize || endY >= (int)BoardSize)
+        return false;
+    int startX = -1, startY = -1;
+    for(size_t i = begin; i < end - 2; i++)
+    {
+        if(text[i] >= 'a' && text[i] < 'a' + (int)BoardSize)
+            startX = text[i] - 'a';
+        else if(text[i] >= '1' && text[i] < '1' + (int)BoardSize)
+            startY = text[i] - '1';
+        else if(text[i] != 'x' && text[i] != '-')
+            return false;
+    }
+    size_t matchCount = 0;
+    for(GameStateMove m : moves)
+    {
+        if(gs.board[m.startX][m.startY] != setPieceColor(piece, gs.player) || (int)m.endX != endX || (int)m.endY != endY)
+            continue;
+        if(m.promoteToType != promotion || (startX != -1 && (int)m.startX != startX) || (startY != -1 && (int)m.startY != startY))
+            continue;
+        if(m.apply(gs).isKingAttacked(gs.player))
+            continue; // a pinned piece, which san doesn't disambiguate
+        result = m;
+        matchCount++;
+    }
+    return matchCount == 1;
+}
+
+void buildOpeningBook(const vector<string> &pgnFileNames, const string &bookFileName, const BookBuilderOptions &options)
+{
+    const size_t threadCount = max<size_t>(options.threadCount, 1);
+    const size_t maxThreadRecordCount = max<size_t>(options.maxRecordsInMemory / threadCount, 1024);
+    const size_t gamesPerBatch = 256;
+    RunFiles runs(bookFileName);
+    GameQueue queue(threadCount * 2);
+    atomic<size_t> usedGameCount(0);
+    mutex errorLock;
+    exception_ptr error;
+    vector<thread> threads;
+    for(size_t i = 0; i < threadCount; i++)
+    {
+        threads.push_back(thread([&]()
+        {
+            try
+            {
+                vector<BookRecord> records;
+                records.reserve(maxThreadRecordCount);
+                vector<string> batch;
+                while(queue.pop(batch))
+                {
+                    for(const string &game : batch)
+                    {
+                        if(parseGame(game, options.maxPly, records))
+                            usedGameCount++;
+                        if(records.size() < maxThreadRecordCount)
+                            continue;
+                        compactRecords(records);
+                        if(records.size() > maxThreadRecordCount / 2)
+                        {
+                            runs.write(records);
+                            records.clear();
+                        }
+                    }
+                }
+                if(!records.empty())
+                {
+                    compactRecords(records);
+                    runs.write(records);
+                }
+            }
+            catch(...)
+            {
+                lock_guard<mutex> lockIt(errorLock);
+                error = current_exception();
+                queue.finish();
+            }
+        }));
+    }
+    // a game starts at a tag line that comes after some moves
+    size_t gameCount = 0;
+    try
+    {
+        vector<string> batch;
+        for(const string &fileName : pgnFileNames)
+        {
+            ifstream is(fileName);
+            if(!is)
+                throw FileError("can't open " + fileName);
+            string game, line;
+            bool hasMoves = false;
+            size_t commentDepth = 0;
+            while(getline(is, line))
+            {
+                if(commentDepth == 0 && !line.empty() && line[0] == '[' && hasMoves)
+                {
+                    batch.push_back(move(game));
+                    game.clear();
+                    hasMoves = false;
+                    gameCount++;
+                    if(batch.size() >= gamesPerBatch)
+                    {
+                        queue.push(move(batch));
+                        batch.clear();
+                    }
+                }
+                if(commentDepth > 0 || (!line.empty() && line[0] != '[' && line.find_first_not_of(" \t\r") != string::npos))
+                    hasMoves = true;
+                for(char ch : line)
+                {
+                    if(ch == '{')
+                        commentDepth++;
+                    else if(ch == '}' && commentDepth > 0)
+                        commentDepth--;
+                }
+                game += line;
+                game += '\n';
+            }
+            if(hasMoves)
+            {
+                batch.push_back(move(game));
+                gameCount++;
+            }
+        }
+        if(!batch.empty())
+            queue.push(move(batch));
+    }
+    catch(...)
+    {
+        queue.finish();
+        for(thread &t : threads)
+            t.join();
+        throw;
+    }
+    queue.finish();
+    for(thread &t : threads)
+        t.join();
+    if(error)
+        rethrow_exception(error);
+    // merge at most maxMergeWidth runs at a time, so the open files and their buffers stay within the memory budget
+    // however many runs there are; the runs of a pass each become one run for the next pass
+    const size_t maxMergeWidth = 64;
+    const size_t mergeBufferSize = max<size_t>(options.maxRecordsInMemory / maxMergeWidth, 1024);
+    while(runs.getFileNames().size() > maxMergeWidth)
+    {
+        const vector<string> fileNames = runs.getFileNames();
+        for(size_t begin = 0; begin < fileNames.size(); begin += maxMergeWidth)
+        {
+            const vector<string> mergedFileNames(fileNames.begin() + begin, fileNames.begin() + min(begin + maxMergeWidth, fileNames.size()));
+            const string fileName = runs.add();
+            ofstream os(fileName, ios::binary);
+            mergeRuns(mergedFileNames, mergeBufferSize, [&](const BookRecord &record)
+            {
+                os.write((const char *)&record, sizeof(record));
+            });
+            os.close();
+            if(!os)
+                throw FileError("can't write " + fileName);
+            runs.removeMerged(mergedFileNames);
+        }
+    }
+    // the last pass writes each position's moves once all of them are added up
+    ofstream os(bookFileName, ios::binary);
+    if(!os)
+        throw FileError("can't write " + bookFileName);
+    size_t entryCount = 0, positionCount = 0;
+    vector<BookRecord> positionMoves;
+    auto writePositionMoves = [&]()
+    {
+        const size_t writtenCount = writePosition(os, positionMoves, options.minGameCount);
+        entryCount += writtenCount;
+        positionCount += (writtenCount > 0 ? 1 : 0);
+        positionMoves.clear();
+    };
+    mergeRuns(runs.getFileNames(), mergeBufferSize, [&](const BookRecord &record)
+    {
+        if(!positionMoves.empty() && positionMoves.back().key != record.key)
+            writePositionMoves();
+        positionMoves.push_back(record);
+    });
+    if(!positionMoves.empty())
+        writePositionMoves();
+    os.close();
+    if(!os)
+        throw FileError("can't write " + bookFileName);
+    if(options.log)
+        *options.log << bookFileName << ": " << usedGameCount << " of " << gameCount << " games, " << positionCount << " positions, " << entryCount << " moves" << endl;
+}
@@ -0,0 +1,22 @@
+#ifndef BOOK_BUILDER_H_INCLUDED
+#define BOOK_BUILDER_H_INCLUDED
+
+#include "game_state.h"
+
+// finds the legal move written as san, like "Nbd7", "exd6", "e8=Q+" or "O-O"
+bool findSanMove(const GameState &gs, const string &san, GameStateMove &result);
+
+struct BookBuilderOptions final
+{
+    size_t threadCount = 1;
+    size_t maxPly = 30; // only the start of each game goes in the book
+    uint32_t minGameCount = 1; // moves played in fewer games are left out
+    size_t maxRecordsInMemory = (size_t)1 << 22; // shared by the threads and by the merge buffers; more are sorted into temporary files
+    ostream *log = nullptr;
+};
+
+// writes a polyglot book of the moves played in the standard games of the pgn files; a move's weight is
+// twice the wins plus the draws of the player making it, scaled down to 16 bits where needed
+void buildOpeningBook(const vector<string> &pgnFileNames, const string &bookFileName, const BookBuilderOptions &options = BookBuilderOptions());
+
+#endif // BOOK_BUILDER_H_INCLUDED
@@ -0,0 +1,257 @@
+#include "evaluation.h"
+
+namespace
+{
+typedef uint64_t Bitboard; // bit getSquareIndex(x, y) for each square
+
+constexpr Bitboard fileA = 0x0101010101010101ULL;
+constexpr Bitboard fileH = fileA << (BoardSize - 1);
+
+// north, east, north east and north west go up the square indexes, the other four go down
+constexpr size_t directionCount = 8;
+const int directionXs[directionCount] = {0, 1, 1, -1, 0, -1, -1, 1};
+const int directionYs[directionCount] = {1, 0, 1, 1, -1, 0, -1, -1};
+const size_t rookDirections[] = {0, 1, 4, 5};
+const size_t bishopDirections[] = {2, 3, 6, 7};
+
+// indexed by getPieceKind; the mobility scores are relative to a typical number of safe squares
+const array<TaperedScore, PieceKindCount> mobilityWeights = {{{0, 0}, {2, 4}, {4, 4}, {5, 5}, {1, 2}, {0, 0}}};
+const array<int, PieceKindCount> mobilityBaselines = {{0, 7, 4, 6, 13, 0}};
+const array<int, PieceKindCount> kingAttackWeights = {{0, 3, 2, 2, 5, 0}};
+constexpr int maxKingDanger = 250; // less than MaxMobilityAndKingSafety so the mobility still counts in an attack
+const array<TaperedScore, 2> pawnShieldBonuses = {{{15, 0}, {8, 0}}}; // for a pawn one or two ranks in front
+
+struct AttackTables final
+{
+    array<Bitboard, BoardSize * BoardSize> knight, king;
+    array<array<Bitboard, BoardSize * BoardSize>, directionCount> rays; // up to the edge, not including the square
+    AttackTables()
+    {
+        for(int x = 0; x < (int)BoardSize; x++)
+        {
+            for(int y = 0; y < (int)BoardSize; y++)
+            {
+                const size_t square = getSquareIndex((size_t)x, (size_t)y);
+                knight[square] = 0;
+                king[square] = 0;
+                for(int dx = -2; dx <= 2; dx++)
+                {
+                    for(int dy = -2; dy <= 2; dy++)
+                    {
+                        if(x + dx < 0 || y + dy < 0 || x + dx >= (int)BoardSize || y + dy >= (int)BoardSize)
+                            continue;
+                        const Bitboard target = (Bitboard)1 << getSquareIndex((size_t)(x + dx), (size_t)(y + dy));
+                        if(abs(dx * dy) == 2)
+                            knight[square] |= target;
+                        else if(abs(dx) <= 1 && abs(dy) <= 1 && (dx != 0 || dy != 0))
+                            king[square] |= target;
+                    }
+                }
+                for(size_t direction = 0; direction < directionCount; direction++)
+                {
+                    rays[direction][square] = 0;
+                    for(int rayX = x + directionXs[direction], rayY = y + directionYs[direction]; rayX >= 0 && rayY >= 0 && rayX < (int)BoardSize && rayY < (int)BoardSize; rayX += directionXs[direction], rayY += directionYs[direction])
+                        rays[direction][square] |= (Bitboard)1 << getSquareIndex((size_t)rayX, (size_t)rayY);
+                }
+            }
+        }
+    }
+};
+
+const AttackTables & getAttackTables()
+{
+    static const AttackTables tables;
+    return tables;
+}
+
+int getPopulationCount(Bitboard bitboard)
+{
+    return __builtin_popcountll(bitboard);
+}
+
+// everything past the first piece in the way is cut off
+Bitboard getRayAttacks(const AttackTables &tables, size_t direction, size_t square, Bitboard occupied)
+{
+    Bitboard attacks = tables.rays[direction][square];
+    const Bitboard blockers = attacks & occupied;
+    if(blockers != 0)
+    {
+        const size_t blocker = (direction < 4 ? (size_t)__builtin_ctzll(blockers) : (size_t)(63 - __builtin_clzll(blockers)));
+        attacks &= ~tables.rays[direction][blocker];
+    }
+    return attacks;
+}
+
+Bitboard getPieceAttacks(const AttackTables &tables, PieceType piece, size_t square, Bitboard occupied)
+{
+    Bitboard retval = 0;
+    switch(setPieceColor(piece, PieceColor::White))
+    {
+    case PieceType::WhiteKnight:
+        return tables.knight[square];
+    case PieceType::WhiteKing:
+        return tables.king[square];
+    case PieceType::WhiteRook:
+        for(size_t direction : rookDirections)
+            retval |= getRayAttacks(tables, direction, square, occupied);
+        return retval;
+    case PieceType::WhiteBishop:
+        for(size_t direction : bishopDirections)
+            retval |= getRayAttacks(tables, direction, square, occupied);
+        return retval;
+    case PieceType::WhiteQueen:
+        for(size_t direction = 0; direction < directionCount; direction++)
+            retval |= getRayAttacks(tables, direction, square, occupied);
+        return retval;
+    default:
+        assert(false);
+        return 0;
+    }
+}
+
+// counts own pawns on the files around a king still near its first rank, by how far in front they are
+array<int, 2> getPawnShield(const GameState &gs, size_t kingX, size_t kingY, PieceColor side)
+{
+    array<int, 2> retval = {{0, 0}};
+    const int forward = (side == PieceColor::White ? 1 : -1);
+    const int rank = (side == PieceColor::White ? (int)kingY : (int)(BoardSize - 1 - kingY));
+    if(rank > 1)
+        return retval;
+    const PieceType pawn = setPieceColor(PieceType::WhitePawn, side);
+    for(int x = max((int)kingX - 1, 0); x <= min((int)kingX + 1, (int)BoardSize - 1); x++)
+    {
+        if(gs.board[x][(int)kingY + forward] == pawn)
+            retval[0]++;
+        else if(gs.board[x][(int)kingY + 2 * forward] == pawn)
+            retval[1]++;
+    }
+    return retval;
+}
+
+// coefficients gets the linear terms if getCoefficients is set; a template so the search's evaluation doesn't pay for it
+template <bool getCoefficients>
+TaperedScore evaluateMobilityAndKingSafety(const GameState &gs, vector<EvaluationCoefficient> *coefficients)
+{
+    const AttackTables &tables = getAttackTables();
+    // indexed by 0 for white and 1 for black
+    array<Bitboard, 2> pieces = {{0, 0}}, pawns = {{0, 0}};
+    array<size_t, 2> kingSquares = {{0, 0}};
+    for(size_t x = 0; x < BoardSize; x++)
+    {
+        for(size_t y = 0; y < BoardSize; y++)
+        {
+            const PieceType piece = gs.board[x][y];
+            if(piece == PieceType::Empty)
+                continue;
+            const size_t side = (getPieceColor(piece) == PieceColor::White ? 0 : 1);
+            const Bitboard bit = (Bitboard)1 << getSquareIndex(x, y);
+            pieces[side] |= bit;
+            if(piece == PieceType::WhitePawn || piece == PieceType::BlackPawn)
+                pawns[side] |= bit;
+            else if(piece == PieceType::WhiteKing || piece == PieceType::BlackKing)
+                kingSquares[side] = getSquareIndex(x, y);
+        }
+    }
+    const Bitboard occupied = pieces[0] | pieces[1];
+    const array<Bitboard, 2> pawnAttacks =
+    {{
+        ((pawns[0] << (BoardSize + 1)) & ~fileA) | ((pawns[0] << (BoardSize - 1)) & ~fileH),
+        ((pawns[1] >> (BoardSize - 1)) & ~fileA) | ((pawns[1] >> (BoardSize + 1)) & ~fileH),
+    }};
+    array<Bitboard, 2> kingZones;
+    for(size_t side = 0; side < 2; side++)
+        kingZones[side] = tables.king[kingSquares[side]] | (Bitboard)1 << kingSquares[side];
+    array<int, 2> middlegame = {{0, 0}}, endgame = {{0, 0}};
+    array<int, 2> kingAttackers = {{0, 0}}, kingAttackUnits = {{0, 0}}; // by the side attacking
+    for(size_t side = 0; side < 2; side++)
+    {
+        const size_t other = 1 - side;
+        const Bitboard safeSquares = ~pieces[side] & ~pawnAttacks[other];
+        for(Bitboard remaining = pieces[side] & ~pawns[side] & ~((Bitboard)1 << kingSquares[side]); remaining != 0; remaining &= remaining - 1)
+        {
+            const size_t square = (size_t)__builtin_ctzll(remaining);
+            const PieceType piece = gs.board[square % BoardSize][square / BoardSize];
+            const size_t kind = getPieceKind(piece);
+            const Bitboard attacks = getPieceAttacks(tables, piece, square, occupied);
+            const int mobility = getPopulationCount(attacks & safeSquares) - mobilityBaselines[kind];
+            middlegame[side] += mobilityWeights[kind].middlegame * mobility;
+            endgame[side] += mobilityWeights[kind].endgame * mobility;
+            if(getCoefficients)
+                coefficients->push_back(EvaluationCoefficient{(uint16_t)(MobilityParameterOffset + kind), (int16_t)(side == 0 ? mobility : -mobility)});
+            const Bitboard kingZoneAttacks = attacks & kingZones[other];
+            if(kingZoneAttacks != 0)
+            {
+                kingAttackers[side]++;
+                kingAttackUnits[side] += kingAttackWeights[kind] * getPopulationCount(kingZoneAttacks);
+            }
+        }
+    }
+    for(size_t side = 0; side < 2; side++)
+    {
+        const size_t other = 1 - side;
+        // a lone attacker can rarely do much, so the danger only counts once a second piece joins in
+        if(kingAttackers[other] >= 2)
+            middlegame[side] -= min(kingAttackUnits[other] * kingAttackUnits[other] / 2, maxKingDanger);
+        const array<int, 2> shield = getPawnShield(gs, kingSquares[side] % BoardSize, kingSquares[side] / BoardSize, side == 0 ? PieceColor::White : PieceColor::Black);
+        for(size_t distance = 0; distance < shield.size(); distance++)
+        {
+            middlegame[side] += pawnShieldBonuses[distance].middlegame * shield[distance];
+            endgame[side] += pawnShieldBonuses[distance].endgame * shield[distance];
+            if(getCoefficients && shield[distance] != 0)
+                coefficients->push_back(EvaluationCoefficient{(uint16_t)(PawnShieldParameterOffset + distance), (int16_t)(side == 0 ? shield[distance] : -shield[distance])});
+        }
+    }
+    const int middlegameScore = max(-MaxMobilityAndKingSafety, min(middlegame[0] - middlegame[1], MaxMobilityAndKingSafety));
+    const int endgameScore = max(-MaxMobilityAndKingSafety, min(endgame[0] - endgame[1], MaxMobilityAndKingSafety));
+    return TaperedScore{(int16_t)middlegameScore, (int16_t)endgameScore};
+}
+}
+
+TaperedScore getMobilityAndKingSafety(const GameState &gs)
+{
+    return evaluateMobilityAndKingSafety<false>(gs, nullptr);
+}
+
+vector<TaperedScore> getEvaluationParameters()
+{
+    vector<TaperedScore> retval(EvaluationParameterCount);
+    for(size_t kind = 0; kind < PieceKindCount; kind++)
+    {
+        retval[PieceValueParameterOffset + kind] = pieceValues[kind];
+        for(size_t square = 0; square < BoardSize * BoardSize; square++)
+            retval[PieceSquareParameterOffset + kind * BoardSize * BoardSize + square] = TaperedScore{middlegamePieceSquareBonuses[kind][square], endgamePieceSquareBonuses[kind][square]};
+        retval[MobilityParameterOffset + kind] = mobilityWeights[kind];
+    }
+    for(size_t distance = 0; distance < pawnShieldBonuses.size(); distance++)
+        retval[PawnShieldParameterOffset + distance] = pawnShieldBonuses[distance];
+    return retval;
+}
+
+TaperedScore getEvaluationCoefficients(const GameState &gs, vector<EvaluationCoefficient> &coefficients)
+{
+    for(size_t x = 0; x < BoardSize; x++)
+    {
+        for(size_t y = 0; y < BoardSize; y++)
+        {
+            const PieceType piece = gs.board[x][y];
+            if(piece == PieceType::Empty)
+                continue;
+            // the same squares getPieceSquareValue uses
+            const bool isWhite = (getPieceColor(piece) == PieceColor::White);
+            const size_t kind = getPieceKind(piece);
+            const size_t square = getSquareIndex(x, isWhite ? BoardSize - 1 - y : y);
+            coefficients.push_back(EvaluationCoefficient{(uint16_t)(PieceValueParameterOffset + kind), (int16_t)(isWhite ? 1 : -1)});
+            coefficients.push_back(EvaluationCoefficient{(uint16_t)(PieceSquareParameterOffset + kind * BoardSize * BoardSize + square), (int16_t)(isWhite ? 1 : -1)});
+        }
+    }
+    // everything but the king danger and the cap is linear, so taking the linear terms out leaves just those
+    const size_t firstMobilityCoefficient = coefficients.size();
+    TaperedScore retval = evaluateMobilityAndKingSafety<true>(gs, &coefficients);
+    for(size_t i = firstMobilityCoefficient; i < coefficients.size(); i++)
+    {
+        const size_t parameter = coefficients[i].parameter;
+        const TaperedScore value = (parameter < PawnShieldParameterOffset ? mobilityWeights[parameter - MobilityParameterOffset] : pawnShieldBonuses[parameter - PawnShieldParameterOffset]);
+        retval -= TaperedScore{(int16_t)(value.middlegame * coefficients[i].count), (int16_t)(value.endgame * coefficients[i].count)};
+    }
+    return retval;
+}
@@ -0,0 +1,37 @@
+#ifndef EVALUATION_H_INCLUDED
+#define EVALUATION_H_INCLUDED
+
+#include "game_state.h"
+
+// white's mobility and king safety minus black's, worked out from attack bitboards rather than the moves:
+// mobility counts the squares each piece attacks that aren't its own side's or attacked by an enemy pawn,
+// and king safety weighs the attacks on the squares around each king and the pawns in front of it
+TaperedScore getMobilityAndKingSafety(const GameState &gs);
+
+// getMobilityAndKingSafety's middlegame and endgame parts are each capped at this either way, which bounds how far
+// the full evaluation can be from the material and piece-square score alone
+constexpr int MaxMobilityAndKingSafety = 300;
+
+// the weights the evaluation is linear in, as one vector for tuning: the piece values and piece-square bonuses by
+// getPieceKind, each table from white's side with rank 8 first, then the mobility weights by getPieceKind, then the
+// bonuses for a pawn one and two ranks in front of the king
+constexpr size_t PieceValueParameterOffset = 0;
+constexpr size_t PieceSquareParameterOffset = PieceValueParameterOffset + PieceKindCount;
+constexpr size_t MobilityParameterOffset = PieceSquareParameterOffset + PieceKindCount * BoardSize * BoardSize;
+constexpr size_t PawnShieldParameterOffset = MobilityParameterOffset + PieceKindCount;
+constexpr size_t EvaluationParameterCount = PawnShieldParameterOffset + 2;
+
+struct EvaluationCoefficient final
+{
+    uint16_t parameter;
+    int16_t count; // how many times the parameter is in white's score, negative for black's
+};
+
+vector<TaperedScore> getEvaluationParameters(); // the values the evaluation uses now
+
+// appends the coefficients of gs's evaluation and returns the part that isn't linear in the parameters, so the
+// score before blending by phase is that plus the sum of each count times its parameter; the kpk bitbase and
+// the end conditions are left out
+TaperedScore getEvaluationCoefficients(const GameState &gs, vector<EvaluationCoefficient> &coefficients);
+
+#endif // EVALUATION_H_INCLUDED
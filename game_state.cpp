@@ -1,9 +1,32 @@
 #include "game_state.h"
+#include "bitbase.h"
+#include "evaluation.h"
+#include "neural_network.h"
+#include "opening_book.h"
+#include "tablebase.h"
 #include <cmath> // for abs
 #include <algorithm>
 
 using namespace std;
 
+uint64_t GameState::getHash() const
+{
+    const ZobristKeys & keys = getZobristKeys();
+    uint64_t retval = pieceHash;
+    if(player == Player::Black)
+        retval ^= keys.blackToMove;
+    if(blackCanCastleLeft)
+        retval ^= keys.blackCanCastleLeft;
+    if(blackCanCastleRight)
+        retval ^= keys.blackCanCastleRight;
+    if(whiteCanCastleLeft)
+        retval ^= keys.whiteCanCastleLeft;
+    if(whiteCanCastleRight)
+        retval ^= keys.whiteCanCastleRight;
+    retval ^= keys.enpassantCapture[enpassantCaptureX][enpassantCaptureY];
+    return retval;
+}
+
 bool GameState::isKingAttacked(Player side) const
 {
     bool kingAttacked = false, kingFound = false;
@@ -89,6 +112,21 @@ bool isTieCondition(GameState gs)
 }
 }
 
+bool GameState::isTieByMaterial() const
+{
+    return isTieCondition(*this);
+}
+
+bool GameState::canCaptureEnpassant() const
+{
+    if(enpassantCaptureY == 0)
+        return false;
+    const PieceType pawn = setPieceColor(PieceType::WhitePawn, player);
+    const size_t y = (player == Player::White ? enpassantCaptureY - 1 : enpassantCaptureY + 1);
+    const size_t x = enpassantCaptureX;
+    return (x > 0 && board[x - 1][y] == pawn) || (x + 1 < BoardSize && board[x + 1][y] == pawn);
+}
+
 void GameState::calcEndCondition(GameStateCache &cache)
 {
     endCondition = EndCondition::Nothing;
@@ -101,64 +139,224 @@ void GameState::calcEndCondition(GameStateCache &cache)
     endConditionSet = true;
 }
 
-void GameState::calcStaticEvaluation(GameStateCache &cache)
+const array<TaperedScore, PieceKindCount> pieceValues =
+{{
+    {100, 120}, // pawn
+    {500, 520}, // rook
+    {320, 300}, // knight
+    {330, 320}, // bishop
+    {900, 920}, // queen
+    {0, 0}, // king
+}};
+
+const array<int, PieceKindCount> piecePhases = {{0, 2, 1, 1, 4, 0}};
+
+const array<array<int16_t, BoardSize * BoardSize>, PieceKindCount> middlegamePieceSquareBonuses =
+{{
+    {{ // pawn
+          0,   0,   0,   0,   0,   0,   0,   0,
+         50,  50,  50,  50,  50,  50,  50,  50,
+         10,  10,  20,  30,  30,  20,  10,  10,
+          5,   5,  10,  25,  25,  10,   5,   5,
+          0,   0,   0,  20,  20,   0,   0,   0,
+          5,  -5, -10,   0,   0, -10,  -5,   5,
+          5,  10,  10, -20, -20,  10,  10,   5,
+          0,   0,   0,   0,   0,   0,   0,   0,
+    }},
+    {{ // rook
+          0,   0,   0,   0,   0,   0,   0,   0,
+          5,  10,  10,  10,  10,  10,  10,   5,
+         -5,   0,   0,   0,   0,   0,   0,  -5,
+         -5,   0,   0,   0,   0,   0,   0,  -5,
+         -5,   0,   0,   0,   0,   0,   0,  -5,
+         -5,   0,   0,   0,   0,   0,   0,  -5,
+         -5,   0,   0,   0,   0,   0,   0,  -5,
+          0,   0,   0,   5,   5,   0,   0,   0,
+    }},
+    {{ // knight
+        -50, -40, -30, -30, -30, -30, -40, -50,
+        -40, -20,   0,   0,   0,   0, -20, -40,
+        -30,   0,  10,  15,  15,  10,   0, -30,
+        -30,   5,  15,  20,  20,  15,   5, -30,
+        -30,   0,  15,  20,  20,  15,   0, -30,
+        -30,   5,  10,  15,  15,  10,   5, -30,
+        -40, -20,   0,   5,   5,   0, -20, -40,
+        -50, -40, -30, -30, -30, -30, -40, -50,
+    }},
+    {{ // bishop
+        -20, -10, -10, -10, -10, -10, -10, -20,
+        -10,   0,   0,   0,   0,   0,   0, -10,
+        -10,   0,   5,  10,  10,   5,   0, -10,
+        -10,   5,   5,  10,  10,   5,   5, -10,
+        -10,   0,  10,  10,  10,  10,   0, -10,
+        -10,  10,  10,  10,  10,  10,  10, -10,
+        -10,   5,   0,   0,   0,   0,   5, -10,
+        -20, -10, -10, -10, -10, -10, -10, -20,
+    }},
+    {{ // queen
+        -20, -10, -10,  -5,  -5, -10, -10, -20,
+        -10,   0,   0,   0,   0,   0,   0, -10,
+        -10,   0,   5,   5,   5,   5,   0, -10,
+         -5,   0,   5,   5,   5,   5,   0,  -5,
+          0,   0,   5,   5,   5,   5,   0,  -5,
+        -10,   5,   5,   5,   5,   5,   0, -10,
+        -10,   0,   5,   0,   0,   0,   0, -10,
+        -20, -10, -10,  -5,  -5, -10, -10, -20,
+    }},
+    {{ // king
+        -30, -40, -40, -50, -50, -40, -40, -30,
+        -30, -40, -40, -50, -50, -40, -40, -30,
+        -30, -40, -40, -50, -50, -40, -40, -30,
+        -30, -40, -40, -50, -50, -40, -40, -30,
+        -20, -30, -30, -40, -40, -30, -30, -20,
+        -10, -20, -20, -20, -20, -20, -20, -10,
+         20,  20,   0,   0,   0,   0,  20,  20,
+         20,  30,  10,   0,   0,  10,  30,  20,
+    }},
+}};
+
+// passed pawns matter more, and the king comes out to the center
+const array<array<int16_t, BoardSize * BoardSize>, PieceKindCount> endgamePieceSquareBonuses =
+{{
+    {{ // pawn
+          0,   0,   0,   0,   0,   0,   0,   0,
+         80,  80,  80,  80,  80,  80,  80,  80,
+         50,  50,  50,  50,  50,  50,  50,  50,
+         30,  30,  30,  30,  30,  30,  30,  30,
+         20,  20,  20,  20,  20,  20,  20,  20,
+         10,  10,  10,  10,  10,  10,  10,  10,
+          0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,
+    }},
+    {{ // rook
+          0,   0,   0,   0,   0,   0,   0,   0,
+         10,  10,  10,  10,  10,  10,  10,  10,
+          0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,
+    }},
+    {{ // knight
+        -50, -40, -30, -30, -30, -30, -40, -50,
+        -40, -20,   0,   0,   0,   0, -20, -40,
+        -30,   0,  10,  15,  15,  10,   0, -30,
+        -30,   5,  15,  20,  20,  15,   5, -30,
+        -30,   0,  15,  20,  20,  15,   0, -30,
+        -30,   5,  10,  15,  15,  10,   5, -30,
+        -40, -20,   0,   5,   5,   0, -20, -40,
+        -50, -40, -30, -30, -30, -30, -40, -50,
+    }},
+    {{ // bishop
+        -20, -10, -10, -10, -10, -10, -10, -20,
+        -10,   0,   0,   0,   0,   0,   0, -10,
+        -10,   0,   5,  10,  10,   5,   0, -10,
+        -10,   5,  10,  15,  15,  10,   5, -10,
+        -10,   5,  10,  15,  15,  10,   5, -10,
+        -10,   0,   5,  10,  10,   5,   0, -10,
+        -10,   0,   0,   0,   0,   0,   0, -10,
+        -20, -10, -10, -10, -10, -10, -10, -20,
+    }},
+    {{ // queen
+        -20, -10, -10,  -5,  -5, -10, -10, -20,
+        -10,   0,   0,   0,   0,   0,   0, -10,
+        -10,   0,   5,   5,   5,   5,   0, -10,
+         -5,   0,   5,  10,  10,   5,   0,  -5,
+         -5,   0,   5,  10,  10,   5,   0,  -5,
+        -10,   0,   5,   5,   5,   5,   0, -10,
+        -10,   0,   0,   0,   0,   0,   0, -10,
+        -20, -10, -10,  -5,  -5, -10, -10, -20,
+    }},
+    {{ // king
+        -50, -40, -30, -20, -20, -30, -40, -50,
+        -30, -20, -10,   0,   0, -10, -20, -30,
+        -30, -10,  20,  30,  30,  20, -10, -30,
+        -30, -10,  30,  40,  40,  30, -10, -30,
+        -30, -10,  30,  40,  40,  30, -10, -30,
+        -30, -10,  20,  30,  30,  20, -10, -30,
+        -30, -30,   0,   0,   0,   0, -30, -30,
+        -50, -30, -30, -30, -30, -30, -30, -50,
+    }},
+}};
+
+void GameState::recalculateMaterial()
+{
+    pieceSquareScore = TaperedScore{0, 0};
+    pieceCounts.fill(0);
+    pieceHash = 0;
+    for(size_t x = 0; x < BoardSize; x++)
+    {
+        for(size_t y = 0; y < BoardSize; y++)
+        {
+            const PieceType piece = board[x][y];
+            board[x][y] = PieceType::Empty;
+            setSquare(x, y, piece);
+        }
+    }
+}
+
+Score GameState::evaluate(GameStateCache &cache, Score worstValue, Score bestValue, bool &exact)
 {
+    exact = true;
     switch(getEndCondition(cache))
     {
     case EndCondition::Lose:
-        staticEvaluation = -1000;
-        staticEvaluationSet = true;
-        return;
+        return -MateScore;
     case EndCondition::Win:
-        staticEvaluation = 1000;
-        staticEvaluationSet = true;
-        return;
+        return MateScore;
     case EndCondition::Tie:
-        staticEvaluation = 0;
-        staticEvaluationSet = true;
-        return;
+        return 0;
     case EndCondition::Nothing:
         break;
     }
-    staticEvaluation = 0;
-    for(size_t x = 0; x < BoardSize; x++)
+    bool pawnSideWins;
+    if(getGamePhase() == 0 && getPieceCount(PieceType::WhitePawn) + getPieceCount(PieceType::BlackPawn) == 1 && probeKPK(*this, pawnSideWins))
     {
-        for(size_t y = 0; y < BoardSize; y++)
+        if(!pawnSideWins)
+            return 0;
+        // a won pawn is worth more than a rook but less than the queen it becomes, so the search still promotes it
+        int winValue = 0;
+        for(size_t x = 0; x < BoardSize; x++)
         {
-            float pieceValue = 0;
-            switch(board[x][y])
+            for(size_t y = 0; y < BoardSize; y++)
             {
-            case PieceType::Empty:
-                break;
-            case PieceType::WhitePawn:
-            case PieceType::BlackPawn:
-                pieceValue = 1;
-                break;
-            case PieceType::WhiteRook:
-            case PieceType::BlackRook:
-                pieceValue = 5;
-                break;
-            case PieceType::WhiteKnight:
-            case PieceType::BlackKnight:
-                pieceValue = 3;
-                break;
-            case PieceType::WhiteBishop:
-            case PieceType::BlackBishop:
-                pieceValue = 3;
-                break;
-            case PieceType::WhiteQueen:
-            case PieceType::BlackQueen:
-                pieceValue = 9;
-                break;
-            case PieceType::WhiteKing:
-            case PieceType::BlackKing:
-                pieceValue = 1000;
-                break;
+                if(board[x][y] == PieceType::WhitePawn || board[x][y] == PieceType::BlackPawn)
+                    winValue = 500 + 50 * (int)(board[x][y] == PieceType::WhitePawn ? y : BoardSize - 1 - y);
             }
-            if(getPieceColor(board[x][y]) == getOpponent(getPieceColor(player)))
-                pieceValue = -pieceValue;
-            staticEvaluation += pieceValue;
         }
+        return (Score)(getPieceCount(setPieceColor(PieceType::WhitePawn, player)) > 0 ? winValue : -winValue);
+    }
+    const SearchParameters &searchParameters = cache.getSearchParameters();
+    if(const NeuralNetwork *network = searchParameters.neuralNetwork.get())
+        return network->evaluate(*this, cache.getNeuralAccumulators());
+    const int phase = getGamePhase();
+    const int sign = (player == Player::White ? 1 : -1);
+    const int materialEvaluation = sign * getTaperedValue(pieceSquareScore, phase);
+    // the skipped terms can't move the score further than their cap, plus one for the rounding in getTaperedValue
+    const int lazyMargin = MaxMobilityAndKingSafety + 1;
+    if(searchParameters.lazyEvaluation && (materialEvaluation + lazyMargin <= worstValue || materialEvaluation - lazyMargin >= bestValue))
+    {
+        exact = false;
+        return (Score)materialEvaluation;
+    }
+    TaperedScore score = pieceSquareScore;
+    score += getMobilityAndKingSafety(*this);
+    return (Score)(sign * getTaperedValue(score, phase));
+}
+
+// the evaluation only depends on the position, so it's shared by every path that reaches it
+void GameState::calcStaticEvaluation(GameStateCache &cache, Score worstValue, Score bestValue)
+{
+    EvaluationCache &evaluationCache = cache.getEvaluationCache();
+    const uint64_t hash = getHash();
+    if(!evaluationCache.probe(hash, staticEvaluation))
+    {
+        bool exact;
+        staticEvaluation = evaluate(cache, worstValue, bestValue, exact);
+        // a lazy score is only good for this window
+        if(exact)
+            evaluationCache.store(hash, staticEvaluation);
     }
     staticEvaluationSet = true;
 }
@@ -278,7 +476,7 @@ bool GameState::isPositionAttackedByKnight(size_t x, size_t y, Player side) cons
         const int yStep = 3 - abs(dx);
         for(const int dy : {-yStep, yStep})
         {
-            if((int)x < dx || (int)y < dy)
+            if((int)x + dx < 0 || (int)y + dy < 0)
                 continue;
             size_t xSearch = x + dx, ySearch = y + dy;
             if(xSearch >= BoardSize || ySearch >= BoardSize)
@@ -299,7 +497,7 @@ bool GameState::isPositionAttackedByKing(size_t x, size_t y, Player side) const
         {
             if(dx == 0 && dy == 0)
                 continue;
-            if((int)x < dx || (int)y < dy)
+            if((int)x + dx < 0 || (int)y + dy < 0)
                 continue;
             size_t xSearch = x + dx, ySearch = y + dy;
             if(xSearch >= BoardSize || ySearch >= BoardSize)
@@ -327,6 +525,142 @@ bool GameState::isPositionAttacked(size_t x, size_t y, Player side) const
     return false;
 }
 
+bool GameState::getLeastValuableAttacker(size_t x, size_t y, PieceColor attackerColor, size_t &attackerX, size_t &attackerY) const
+{
+    assert(x < BoardSize && y < BoardSize && attackerColor != PieceColor::None);
+    const PieceType pawn = setPieceColor(PieceType::WhitePawn, attackerColor);
+    const PieceType knight = setPieceColor(PieceType::WhiteKnight, attackerColor);
+    const PieceType bishop = setPieceColor(PieceType::WhiteBishop, attackerColor);
+    const PieceType rook = setPieceColor(PieceType::WhiteRook, attackerColor);
+    const PieceType queen = setPieceColor(PieceType::WhiteQueen, attackerColor);
+    const PieceType king = setPieceColor(PieceType::WhiteKing, attackerColor);
+    const int pawnY = (int)y - (attackerColor == PieceColor::White ? 1 : -1);
+    if(pawnY >= 0 && (size_t)pawnY < BoardSize)
+    {
+        for(int dx : {-1, 1})
+        {
+            const int pawnX = (int)x + dx;
+            if(pawnX >= 0 && (size_t)pawnX < BoardSize && board[pawnX][pawnY] == pawn)
+            {
+                attackerX = pawnX;
+                attackerY = pawnY;
+                return true;
+            }
+        }
+    }
+    for(const int dx : {-2, -1, 1, 2})
+    {
+        const int yStep = 3 - abs(dx);
+        for(const int dy : {-yStep, yStep})
+        {
+            const int searchX = (int)x + dx, searchY = (int)y + dy;
+            if(searchX < 0 || (size_t)searchX >= BoardSize || searchY < 0 || (size_t)searchY >= BoardSize)
+                continue;
+            if(board[searchX][searchY] == knight)
+            {
+                attackerX = searchX;
+                attackerY = searchY;
+                return true;
+            }
+        }
+    }
+    bool haveRook = false, haveQueen = false, haveKing = false;
+    size_t rookX = 0, rookY = 0, queenX = 0, queenY = 0, kingX = 0, kingY = 0;
+    for(int dx : {-1, 0, 1})
+    {
+        for(int dy : {-1, 0, 1})
+        {
+            if(dx == 0 && dy == 0)
+                continue;
+            const bool diagonal = (dx != 0 && dy != 0);
+            for(int searchX = (int)x + dx, searchY = (int)y + dy; searchX >= 0 && (size_t)searchX < BoardSize && searchY >= 0 && (size_t)searchY < BoardSize; searchX += dx, searchY += dy)
+            {
+                const PieceType piece = board[searchX][searchY];
+                if(piece == PieceType::Empty)
+                    continue;
+                if(diagonal && piece == bishop)
+                {
+                    attackerX = searchX;
+                    attackerY = searchY;
+                    return true;
+                }
+                if(!diagonal && piece == rook && !haveRook)
+                {
+                    haveRook = true;
+                    rookX = searchX;
+                    rookY = searchY;
+                }
+                else if(piece == queen && !haveQueen)
+                {
+                    haveQueen = true;
+                    queenX = searchX;
+                    queenY = searchY;
+                }
+                else if(piece == king && abs(searchX - (int)x) <= 1 && abs(searchY - (int)y) <= 1)
+                {
+                    haveKing = true;
+                    kingX = searchX;
+                    kingY = searchY;
+                }
+                break;
+            }
+        }
+    }
+    if(haveRook)
+    {
+        attackerX = rookX;
+        attackerY = rookY;
+        return true;
+    }
+    if(haveQueen)
+    {
+        attackerX = queenX;
+        attackerY = queenY;
+        return true;
+    }
+    if(haveKing)
+    {
+        attackerX = kingX;
+        attackerY = kingY;
+        return true;
+    }
+    return false;
+}
+
+int GameState::getStaticExchangeEvaluation(GameStateMove m) const
+{
+    GameState gs = *this;
+    PieceType pieceOnSquare = gs.board[m.startX][m.startY];
+    PieceColor side = getPieceColor(pieceOnSquare);
+    assert(side != PieceColor::None);
+    array<int, 32> gain;
+    size_t depth = 0;
+    gain[0] = getPieceValue(gs.board[m.captureX][m.captureY]);
+    if(m.promoteToType != PieceType::Empty)
+    {
+        gain[0] += getPieceValue(m.promoteToType) - getPieceValue(pieceOnSquare);
+        pieceOnSquare = m.promoteToType;
+    }
+    gs.board[m.startX][m.startY] = PieceType::Empty;
+    gs.board[m.captureX][m.captureY] = PieceType::Empty;
+    gs.board[m.endX][m.endY] = pieceOnSquare;
+    // removing each attacker from the board uncovers any x-ray attackers behind it
+    size_t attackerX, attackerY;
+    for(side = getOpponent(side); depth + 1 < gain.size() && gs.getLeastValuableAttacker(m.endX, m.endY, side, attackerX, attackerY); side = getOpponent(side))
+    {
+        depth++;
+        gain[depth] = getPieceValue(pieceOnSquare) - gain[depth - 1];
+        pieceOnSquare = gs.board[attackerX][attackerY];
+        gs.board[attackerX][attackerY] = PieceType::Empty;
+        gs.board[m.endX][m.endY] = pieceOnSquare;
+    }
+    for(; depth > 0; depth--)
+    {
+        gain[depth - 1] = -max(-gain[depth - 1], gain[depth]);
+    }
+    return gain[0];
+}
+
 namespace
 {
 void addPawnMove(GameStateCache::MovesList & moves, GameStateMove m, Player player)
@@ -543,6 +877,27 @@ void shrinkToFit(T & v)
 }
 }
 
+void GameStateCache::generatePseudoLegalMoves(GameState gs, MovesList &moves)
+{
+    addPawnMoves(moves, gs);
+    addRookBishopQueenAndKingMoves(moves, gs);
+    addKnightMoves(moves, gs);
+    addCastlingMoves(moves, gs);
+}
+
+void GameStateCache::generateValidMoves(GameState gs, MovesList &moves)
+{
+    generatePseudoLegalMoves(gs, moves);
+    for(auto i = moves.begin(); i != moves.end();)
+    {
+        GameState finalState = i->apply(gs);
+        if(finalState.isKingAttacked(gs.player))
+            i = moves.erase(i);
+        else
+            i++;
+    }
+}
+
 const GameStateCache::MovesList & GameStateCache::getValidMoves(GameState gs)
 {
     Data & data = getGameStateEntry(gs);
@@ -554,25 +909,12 @@ const GameStateCache::MovesList & GameStateCache::getValidMoves(GameState gs)
         data.calculated = true;
         return data.validMoves;
     }
-    addPawnMoves(data.validMoves, gs);
-    addRookBishopQueenAndKingMoves(data.validMoves, gs);
-    addKnightMoves(data.validMoves, gs);
-    addCastlingMoves(data.validMoves, gs);
-    for(auto i = data.validMoves.begin(); i != data.validMoves.end();)
-    {
-        GameState finalState = i->apply(gs);
-        if(finalState.isKingAttacked(gs.player))
-            i = data.validMoves.erase(i);
-        else
-            i++;
-    }
+    generateValidMoves(gs, data.validMoves);
     shrinkToFit(data.validMoves);
     data.calculated = true;
     return data.validMoves;
 }
 
-constexpr float eps = 1e-4;
-
 void GameState::drawChessBoard(GameStateCache &cache, bool useUnicode, bool moveToHome, int startX, int startY, int endX, int endY) const
 {
     if(moveToHome)
@@ -666,100 +1008,416 @@ void GameState::drawChessBoard(GameStateCache &cache, bool useUnicode, bool move
         cout << flush;
 }
 
-float GameStateCache::evaluateMoveHelper(GameState gs, atomic_bool &canceled, int depth, float bestValue, float worstValue)
+namespace
 {
-    if(depth <= 0)
-        return gs.getStaticEvaluation(*this);
+int getPieceOrderingRank(PieceType piece)
+{
+    switch(piece)
+    {
+    case PieceType::Empty:
+        return 0;
+    case PieceType::WhitePawn:
+    case PieceType::BlackPawn:
+        return 1;
+    case PieceType::WhiteKnight:
+    case PieceType::BlackKnight:
+        return 2;
+    case PieceType::WhiteBishop:
+    case PieceType::BlackBishop:
+        return 3;
+    case PieceType::WhiteRook:
+    case PieceType::BlackRook:
+        return 4;
+    case PieceType::WhiteQueen:
+    case PieceType::BlackQueen:
+        return 5;
+    case PieceType::WhiteKing:
+    case PieceType::BlackKing:
+        return 6;
+    }
+    assert(false);
+    return 0;
+}
+
+// most valuable victim first, then least valuable attacker
+float getMvvLvaScore(const GameState &gs, GameStateMove m)
+{
+    int victimValue = getPieceValue(gs.board[m.captureX][m.captureY]);
+    if(m.promoteToType != PieceType::Empty)
+        victimValue += getPieceValue(m.promoteToType) - getPieceValue(gs.board[m.startX][m.startY]);
+    return (float)(victimValue * 8 - getPieceOrderingRank(gs.board[m.startX][m.startY]));
+}
+
+struct SortingEntry final
+{
+    GameStateMove move;
+    int category;
+    float value;
+    SortingEntry(GameStateMove move, int category, float value)
+        : move(move), category(category), value(value)
+    {
+    }
+    friend bool operator <(const SortingEntry &l, const SortingEntry &r)
+    {
+        if(l.category != r.category)
+            return l.category > r.category;
+        return l.value > r.value;
+    }
+};
+}
+
+Score GameStateCache::getEndConditionScore(EndCondition endCondition, size_t ply)
+{
+    switch(endCondition)
+    {
+    case EndCondition::Win:
+        return getMateScore(ply);
+    case EndCondition::Lose:
+        return getMatedScore(ply);
+    case EndCondition::Tie:
+    case EndCondition::Nothing:
+        break;
+    }
+    return 0;
+}
+
+Score GameStateCache::quiescenceSearch(GameState gs, SearchContext &context, size_t ply, Score bestValue, Score worstValue, GameState *leaf)
+{
+    if(leaf)
+        *leaf = gs;
+    if(context.poll())
+        return 0;
+    context.counts.quiescenceNodes++;
+    context.reachedPly(ply);
     EndCondition endCondition = gs.getEndCondition(*this);
     if(endCondition != EndCondition::Nothing)
+        return getEndConditionScore(endCondition, ply);
+    Score retval = gs.getStaticEvaluation(*this, worstValue, bestValue);
+    if(retval >= bestValue)
+        return retval;
+    retval = max(retval, worstValue);
+    vector<SortingEntry> captures;
+    for(GameStateMove m : getValidMoves(gs))
     {
-        if(endCondition == EndCondition::Win)
-            return 1000;
-        if(endCondition == EndCondition::Lose)
-            return -1000;
+        if(m.isQuiet(gs))
+            continue;
+        if(gs.getStaticExchangeEvaluation(m) < 0)
+            continue;
+        captures.push_back(SortingEntry(m, 0, getMvvLvaScore(gs, m)));
+    }
+    sort(captures.begin(), captures.end());
+    GameState childLeaf;
+    for(const SortingEntry &capture : captures)
+    {
+        Score v = -quiescenceSearch(capture.move.apply(gs), context, ply + 1, -retval, -bestValue, leaf ? &childLeaf : nullptr);
+        if(context.stopped)
+            return retval;
+        if(leaf && v > retval)
+            *leaf = childLeaf;
+        retval = max(retval, v);
+        if(retval >= bestValue)
+            return retval;
+    }
+    return retval;
+}
+
+Score GameStateCache::getQuiescenceScore(GameState gs, GameState *leaf)
+{
+    atomic_bool canceled(false);
+    SearchContext context(canceled, searchParameters.cancelCheckNodeInterval, GameHistory(), liveStatistics);
+    return quiescenceSearch(gs, context, 0, MateScore, -MateScore, leaf);
+}
+
+int GameStateCache::getSearchExtension(GameState childGs, size_t moveCount, bool singular, int extensionBudget) const
+{
+    if(extensionBudget <= 0)
         return 0;
+    if(searchParameters.checkExtensions && childGs.isKingAttacked())
+        return 1;
+    if(searchParameters.singleReplyExtensions && moveCount == 1)
+        return 1;
+    if(singular)
+        return 1;
+    return 0;
+}
+
+// a move is singular if every other move fails low against a window below the cached value of the move
+bool GameStateCache::isSingularMove(GameState gs, SearchContext &context, const MovesList &moves, GameStateMove ttMove, Score ttValue, int depth, size_t ply)
+{
+    const Score singularBeta = ttValue - searchParameters.singularMargin;
+    for(auto m : moves)
+    {
+        if(m == ttMove)
+            continue;
+        const GameState childGs = m.apply(gs);
+        context.history.push(childGs, m.isIrreversible(gs));
+        Score v = -evaluateMoveHelper(childGs, context, depth / 2 - 1, ply + 1, 0, -(singularBeta - 1), -singularBeta);
+        context.history.pop();
+        if(context.stopped || v >= singularBeta)
+            return false;
     }
-    if(canceled)
-        throw CanceledMove();
-    Data & data = getGameStateEntry(gs);
-    sortValidMoves(data);
-    const MovesList moves = getValidMoves(gs);
-    assert(moves.size() != 0);
-    if(data.evaluationValue.size() < (size_t)depth + 1)
-        data.evaluationValue.resize((size_t)depth + 1);
-    EvaluationEntry &evaluationEntry = data.evaluationValue[depth];
-    if(evaluationEntry.haveMin)
+    return true;
+}
+
+Score GameStateCache::evaluateMoveHelper(GameState gs, SearchContext &context, int depth, size_t ply, int extensionBudget, Score bestValue, Score worstValue)
+{
+    // a repeated position is a draw no matter how deep it is; the draw only holds on this path so it is never cached
+    const size_t repetitionDistance = context.history.findRepetition();
+    if(repetitionDistance != 0 || context.history.isFiftyMoveRuleDraw())
     {
-        if(evaluationEntry.minValue >= bestValue)
-            return evaluationEntry.minValue;
-        if(evaluationEntry.minValue > worstValue)
-            worstValue = evaluationEntry.minValue;
+        const size_t dependencyDistance = (repetitionDistance != 0 ? repetitionDistance : context.history.getHalfmoveClock());
+        context.pathDependencyPly = min(context.pathDependencyPly, (int)ply - (int)dependencyDistance);
+        return 0;
     }
-    if(evaluationEntry.haveMax)
+    if(depth <= 0)
+        return quiescenceSearch(gs, context, ply, bestValue, worstValue);
+    EndCondition endCondition = gs.getEndCondition(*this);
+    if(endCondition != EndCondition::Nothing)
+        return getEndConditionScore(endCondition, ply);
+    if(context.poll())
+        return 0;
+    context.reachedPly(ply);
+    const uint64_t hash = context.history.getHash();
+    assert(hash == gs.getHash());
+    // the tables assume the fifty-move counter was just reset, which is also where the piece count drops
+    const Tablebase *tablebase = searchParameters.tablebase.get();
+    if(tablebase && context.history.getHalfmoveClock() == 0 && tablebase->canProbe(gs))
     {
-        if(evaluationEntry.maxValue <= worstValue)
-            return evaluationEntry.maxValue;
-        if(evaluationEntry.maxValue < bestValue)
-            bestValue = evaluationEntry.maxValue;
+        TablebaseWDL wdl;
+        if(tablebase->probeWDL(gs, wdl))
+        {
+            context.counts.tablebaseHits++;
+            const Score value = getTablebaseScore(wdl, ply);
+            transpositionTable->store(hash, depth, scoreToCache(value, ply), scoreToCache(value, ply), 0);
+            return value;
+        }
     }
-    float retval = worstValue;
-    for(auto m : moves)
+    TranspositionTable::Entry ttEntry;
+    const bool haveTTEntry = transpositionTable->probe(hash, ttEntry);
+    context.counts.transpositionTableProbes++;
+    if(haveTTEntry)
+        context.counts.transpositionTableHits++;
+    if(haveTTEntry && ttEntry.depth >= depth)
     {
-        try
+        if(ttEntry.hasLowerBound())
         {
-            float v = -evaluateMoveHelper(m.apply(gs), canceled, depth - 1, -retval, -bestValue);
-            retval = max(retval, v);
+            const Score minValue = scoreFromCache(ttEntry.lowerBound, ply);
+            if(minValue >= bestValue)
+            {
+                context.counts.transpositionTableCutoffs++;
+                return minValue;
+            }
+            if(minValue > worstValue)
+                worstValue = minValue;
         }
-        catch(CanceledMove &e)
+        if(ttEntry.hasUpperBound())
         {
-            if(retval != worstValue)
+            const Score maxValue = scoreFromCache(ttEntry.upperBound, ply);
+            if(maxValue <= worstValue)
             {
-                if(!evaluationEntry.haveMin || evaluationEntry.minValue < retval)
-                {
-                    evaluationEntry.haveMin = true;
-                    evaluationEntry.minValue = retval;
-                }
+                context.counts.transpositionTableCutoffs++;
+                return maxValue;
             }
-            throw e;
+            if(maxValue < bestValue)
+                bestValue = maxValue;
         }
-        if(retval >= bestValue)
+    }
+    sortValidMoves(gs, ply, haveTTEntry ? ttEntry.move : 0);
+    const MovesList moves = getValidMoves(gs);
+    assert(moves.size() != 0);
+    const int savedPathDependencyPly = context.beginPathDependencyTracking();
+    bool futile = false;
+    if((size_t)depth < searchParameters.futilityMargins.size() && !gs.isKingAttacked())
+    {
+        // only whether the margins reach worstValue matters
+        const Score margin = max(searchParameters.futilityMargins[depth], (size_t)depth < searchParameters.razoringMargins.size() ? searchParameters.razoringMargins[depth] : (Score)0);
+        const int staticEvaluation = gs.getStaticEvaluation(*this, worstValue - margin, bestValue);
+        if((size_t)depth < searchParameters.razoringMargins.size() && staticEvaluation + searchParameters.razoringMargins[depth] <= worstValue)
         {
-            if(!evaluationEntry.haveMin || evaluationEntry.minValue < retval)
+            Score v = quiescenceSearch(gs, context, ply, bestValue, worstValue);
+            if(depth == 1 || v <= worstValue)
             {
-                evaluationEntry.haveMin = true;
-                evaluationEntry.minValue = retval;
+                context.endPathDependencyTracking(savedPathDependencyPly, ply);
+                return v;
             }
-            return retval;
         }
+        futile = (staticEvaluation + searchParameters.futilityMargins[depth] <= worstValue);
     }
-    if(!evaluationEntry.haveMax || evaluationEntry.maxValue > retval)
+    GameStateMove ttMove;
+    if(haveTTEntry && ttEntry.move != 0 && TranspositionTable::encodeMove(moves.front()) == ttEntry.move)
+        ttMove = moves.front();
+    bool ttMoveSingular = false;
+    if(extensionBudget > 0 && depth >= searchParameters.singularExtensionMinDepth && !ttMove.isNull() && moves.size() > 1)
     {
-        evaluationEntry.haveMax = true;
-        evaluationEntry.maxValue = retval;
+        if(ttEntry.hasLowerBound() && ttEntry.depth + 3 >= depth)
+        {
+            const Score ttValue = scoreFromCache(ttEntry.lowerBound, ply);
+            if(!isDecisiveScore(ttValue))
+                ttMoveSingular = isSingularMove(gs, context, moves, ttMove, ttValue, depth, ply);
+        }
     }
-    if(retval != worstValue)
+    Score retval = worstValue;
+    GameStateMove bestMove;
+    bool cutoff = false;
+    bool searchedAnyMove = false;
+    for(size_t moveIndex = 0; moveIndex < moves.size(); moveIndex++)
     {
-        if(!evaluationEntry.haveMin || evaluationEntry.minValue < retval)
+        // young brothers wait: only split once a move has been searched and the node is likely to need all of them
+        if(context.parallel && searchedAnyMove && depth >= searchParameters.minSplitDepth && moves.size() - moveIndex >= 2)
         {
-            evaluationEntry.haveMin = true;
-            evaluationEntry.minValue = retval;
+            split(gs, context, moves, moveIndex, depth, ply, extensionBudget, futile, ttMove, ttMoveSingular, bestValue, retval, bestMove);
+            cutoff = !context.stopped && retval >= bestValue;
+            break;
+        }
+        const GameStateMove m = moves[moveIndex];
+        Score v;
+        if(!searchChild(gs, context, m, moves.size(), depth, ply, extensionBudget, futile, ttMoveSingular && m == ttMove, bestValue, retval, v))
+            continue;
+        searchedAnyMove = true;
+        if(context.stopped)
+            break;
+        if(v > retval)
+            bestMove = m;
+        retval = max(retval, v);
+        if(retval >= bestValue)
+        {
+            cutoff = true;
+            break;
         }
     }
+    const bool cacheable = context.endPathDependencyTracking(savedPathDependencyPly, ply);
+    if(context.stopped)
+    {
+        // only the moves that were completely searched count
+        if(cacheable && retval != worstValue)
+            transpositionTable->store(hash, depth, scoreToCache(retval, ply), TranspositionTable::noUpperBound, TranspositionTable::encodeMove(bestMove));
+        return retval;
+    }
+    if(cutoff)
+    {
+        context.counts.betaCutoffs++;
+        const size_t cutoffMoveIndex = std::find(moves.begin(), moves.end(), bestMove) - moves.begin();
+        if(cutoffMoveIndex == 0)
+            context.counts.firstMoveCutoffs++;
+        context.counts.cutoffMoveIndexSum += cutoffMoveIndex;
+        context.counts.cutoffsBySource[(size_t)getMoveOrderingSource(gs, ply, bestMove, haveTTEntry ? ttEntry.move : 0)]++;
+        if(bestMove.isQuiet(gs))
+        {
+            moveOrdering.addKiller(ply, bestMove);
+            moveOrdering.addHistory(gs.player, bestMove, depth);
+        }
+        if(cacheable)
+            transpositionTable->store(hash, depth, scoreToCache(retval, ply), TranspositionTable::noUpperBound, TranspositionTable::encodeMove(bestMove));
+        return retval;
+    }
+    if(cacheable)
+    {
+        const Score lowerBound = (retval != worstValue ? scoreToCache(retval, ply) : TranspositionTable::noLowerBound);
+        transpositionTable->store(hash, depth, lowerBound, scoreToCache(retval, ply), TranspositionTable::encodeMove(bestMove));
+    }
     return retval;
 }
 
-float GameStateCache::evaluateMove(GameState gs, atomic_bool &canceled, int depth)
+// returns false if the move was pruned
+bool GameStateCache::searchChild(GameState gs, SearchContext &context, GameStateMove m, size_t moveCount, int depth, size_t ply, int extensionBudget, bool futile, bool singular, Score bestValue, Score worstValue, Score &value)
 {
-#if 1
-    float minV = -1000;
-    float maxV = 1000;
-    float evalValue = minV;
-    while(maxV - minV > eps)
-    {
-        float midPoint = (minV + maxV) * 0.5f;
-        float nextValue = midPoint + eps;
-        assert(nextValue > midPoint);
-        evalValue = evaluateMoveHelper(gs, canceled, depth, nextValue, midPoint);
+    const GameState childGs = m.apply(gs);
+    if(futile && m.isQuiet(gs) && !childGs.isKingAttacked())
+        return false;
+    const int extension = getSearchExtension(childGs, moveCount, singular, extensionBudget);
+    context.history.push(childGs, m.isIrreversible(gs));
+    value = -evaluateMoveHelper(childGs, context, depth - 1 + extension, ply + 1, extensionBudget - extension, -worstValue, -bestValue);
+    context.history.pop();
+    return true;
+}
+
+struct GameStateCache::ParallelSearch final
+{
+    WorkStealingScheduler scheduler;
+    vector<GameStateCache *> caches; // indexed by worker
+    LiveSearchStatistics &statistics;
+    ParallelSearch(const vector<GameStateCache *> &caches, LiveSearchStatistics &statistics)
+        : scheduler(caches.size()), caches(caches), statistics(statistics)
+    {
+    }
+};
+
+void GameStateCache::searchSplitPoint(SplitPoint &splitPoint, ParallelSearch &parallel, size_t workerIndex)
+{
+    SearchContext context(splitPoint.canceled, searchParameters.cancelCheckNodeInterval, splitPoint.history, parallel.statistics);
+    context.parallel = &parallel;
+    context.workerIndex = workerIndex;
+    context.splitPoint = &splitPoint;
+    for(;;)
+    {
+        GameStateMove m;
+        Score worstValue;
+        {
+            lock_guard<mutex> lockIt(splitPoint.lock);
+            if(splitPoint.cutoff || splitPoint.nextMoveIndex >= splitPoint.moves.size())
+                break;
+            m = splitPoint.moves[splitPoint.nextMoveIndex++];
+            worstValue = splitPoint.worstValue;
+        }
+        Score v;
+        if(!searchChild(splitPoint.gs, context, m, splitPoint.moves.size(), splitPoint.depth, splitPoint.ply, splitPoint.extensionBudget, splitPoint.futile, splitPoint.ttMoveSingular && m == splitPoint.ttMove, splitPoint.bestValue, worstValue, v))
+            continue;
+        if(context.stopped)
+            break;
+        lock_guard<mutex> lockIt(splitPoint.lock);
+        if(v > splitPoint.worstValue)
+        {
+            splitPoint.worstValue = v;
+            splitPoint.bestMove = m;
+            if(v >= splitPoint.bestValue)
+                splitPoint.cutoff = true;
+        }
+    }
+    lock_guard<mutex> lockIt(splitPoint.lock);
+    splitPoint.pathDependencyPly = min(splitPoint.pathDependencyPly, context.pathDependencyPly);
+}
+
+// searches moves from nextMoveIndex on together with any idle workers and merges the result into retval and bestMove
+void GameStateCache::split(GameState gs, SearchContext &context, const MovesList &moves, size_t nextMoveIndex, int depth, size_t ply, int extensionBudget, bool futile, GameStateMove ttMove, bool ttMoveSingular, Score bestValue, Score &retval, GameStateMove &bestMove)
+{
+    ParallelSearch &parallel = *context.parallel;
+    SplitPoint splitPoint(context.splitPoint, gs, context.history, moves, nextMoveIndex, depth, ply, extensionBudget, bestValue, retval, futile, ttMove, ttMoveSingular, context.canceled);
+    splitPoint.bestMove = bestMove;
+    const size_t taskCount = min(parallel.scheduler.getWorkerCount() - 1, moves.size() - nextMoveIndex - 1);
+    splitPoint.activeTasks = taskCount;
+    for(size_t i = 0; i < taskCount; i++)
+    {
+        parallel.scheduler.push(context.workerIndex, [&splitPoint, &parallel](size_t workerIndex)
+        {
+            parallel.caches[workerIndex]->searchSplitPoint(splitPoint, parallel, workerIndex);
+            splitPoint.activeTasks--;
+        }, &splitPoint);
+    }
+    searchSplitPoint(splitPoint, parallel, context.workerIndex);
+    // the tasks nobody stole are still on our deque, so this can't wait on work that never starts
+    while(splitPoint.activeTasks > 0)
+    {
+        if(!parallel.scheduler.runOwnTask(context.workerIndex, &splitPoint))
+            this_thread::yield();
+    }
+    retval = splitPoint.worstValue;
+    bestMove = splitPoint.bestMove;
+    context.pathDependencyPly = min(context.pathDependencyPly, splitPoint.pathDependencyPly);
+    context.checkStop();
+}
+
+// bisects the score with null-window searches until the bounds meet
+Score GameStateCache::evaluateMove(GameState gs, SearchContext &context, int depth, size_t ply, int extensionBudget)
+{
+    Score minV = -MateScore;
+    Score maxV = MateScore;
+    Score evalValue = minV;
+    while(minV < maxV)
+    {
+        Score midPoint = minV + (maxV - minV) / 2;
+        evalValue = evaluateMoveHelper(gs, context, depth, ply, extensionBudget, midPoint + 1, midPoint);
+        if(context.stopped)
+            break;
         if(evalValue > midPoint)
         {
             minV = evalValue;
@@ -770,60 +1428,344 @@ float GameStateCache::evaluateMove(GameState gs, atomic_bool &canceled, int dept
         }
     }
     return evalValue;
-#else
-    return evaluateMoveHelper(gs, depth, 1000, -1000);
-#endif
 }
 
-GameStateMove GameStateCache::getBestMove(GameState gs, atomic_bool &canceled, int depth, atomic<float> *progress)
+void GameStateCache::seedPrincipalVariation(GameState gs, const vector<GameStateMove> &principalVariation)
+{
+    for(GameStateMove m : principalVariation)
+    {
+        transpositionTable->storeMove(gs.getHash(), TranspositionTable::encodeMove(m));
+        gs = m.apply(gs);
+    }
+}
+
+vector<GameStateMove> GameStateCache::getPrincipalVariation(GameState gs, GameStateMove firstMove, size_t maxLength)
+{
+    vector<GameStateMove> retval{firstMove};
+    vector<GameState> visited{gs};
+    gs = firstMove.apply(gs);
+    while(retval.size() < maxLength && gs.getEndCondition(*this) == EndCondition::Nothing)
+    {
+        if(std::find(visited.begin(), visited.end(), gs) != visited.end())
+            break;
+        visited.push_back(gs);
+        TranspositionTable::Entry entry;
+        if(!transpositionTable->probe(gs.getHash(), entry) || entry.move == 0)
+            break;
+        const MovesList & moves = getValidMoves(gs);
+        auto iter = std::find_if(moves.begin(), moves.end(), [&entry](GameStateMove m)
+        {
+            return TranspositionTable::encodeMove(m) == entry.move;
+        });
+        if(iter == moves.end())
+            break;
+        retval.push_back(*iter);
+        gs = iter->apply(gs);
+    }
+    return retval;
+}
+
+namespace
+{
+struct RootMove final
+{
+    GameStateMove move;
+    Score score = 0;
+    RootMove(GameStateMove move)
+        : move(move)
+    {
+    }
+};
+
+// keeps only the moves that keep the best tablebase result and, when winning or losing, the ones
+// that reach the next capture or pawn move soonest or latest so the search can't waste the win
+void filterTablebaseRootMoves(const Tablebase &tablebase, GameState gs, vector<RootMove> &rootMoves)
+{
+    if(!tablebase.canProbe(gs))
+        return;
+    vector<TablebaseWDL> results;
+    TablebaseWDL bestResult = TablebaseWDL::Loss;
+    for(const RootMove &rootMove : rootMoves)
+    {
+        // the tables leave out the materials that can't mate, like a lone minor piece
+        const GameState child = rootMove.move.apply(gs);
+        TablebaseWDL childResult = TablebaseWDL::Draw;
+        if(!child.isTieByMaterial() && !tablebase.probeWDL(child, childResult))
+            return;
+        results.push_back(-childResult);
+        bestResult = max(bestResult, results.back());
+    }
+    vector<RootMove> bestMoves;
+    vector<int> distances;
+    bool haveDistances = true;
+    for(size_t i = 0; i < rootMoves.size(); i++)
+    {
+        if(results[i] != bestResult)
+            continue;
+        GameStateMove m = rootMoves[i].move;
+        int childDTZ = 0;
+        // a capture or pawn move starts the distance to the next one over, but not the distance to mate
+        if((tablebase.hasDistanceToMate() || !m.isIrreversible(gs)) && !tablebase.probeDTZ(m.apply(gs), childDTZ))
+            haveDistances = false;
+        bestMoves.push_back(rootMoves[i]);
+        distances.push_back(abs(childDTZ));
+    }
+    if(haveDistances && bestResult != TablebaseWDL::Draw)
+    {
+        const bool winning = (bestResult == TablebaseWDL::Win || bestResult == TablebaseWDL::CursedWin);
+        const int bestDistance = (winning ? *min_element(distances.begin(), distances.end()) : *max_element(distances.begin(), distances.end()));
+        vector<RootMove> closestMoves;
+        for(size_t i = 0; i < bestMoves.size(); i++)
+        {
+            if(distances[i] == bestDistance)
+                closestMoves.push_back(bestMoves[i]);
+        }
+        bestMoves.swap(closestMoves);
+    }
+    rootMoves.swap(bestMoves);
+}
+}
+
+// helperIndex is 0 for the main search; helpers use it to vary their depths and move order
+SearchResult GameStateCache::search(GameState gs, atomic_bool &canceled, int depth, atomic<float> *progress, const GameHistory *history, size_t helperIndex, LiveSearchStatistics &statistics, ParallelSearch *parallel)
+{
+    moveOrdering.clearKillers();
+    moveOrdering.ageHistory();
+    sortValidMoves(gs, 0, 0);
+    vector<RootMove> rootMoves;
+    for(GameStateMove m : getValidMoves(gs))
+        rootMoves.push_back(RootMove(m));
+    assert(rootMoves.size() != 0);
+    if(searchParameters.tablebase)
+        filterTablebaseRootMoves(*searchParameters.tablebase, gs, rootMoves);
+    rotate(rootMoves.begin(), rootMoves.begin() + helperIndex % rootMoves.size(), rootMoves.end());
+    SearchContext context(canceled, searchParameters.cancelCheckNodeInterval, history ? *history : GameHistory(), statistics);
+    if(context.history.empty())
+        context.history.push(gs, false);
+    assert(context.history.getHash() == gs.getHash());
+    context.parallel = parallel;
+    SearchResult result;
+    for(int iterationDepth = 1 + (int)(helperIndex % 2); iterationDepth <= depth; iterationDepth++)
+    {
+        if(helperIndex == 0)
+        {
+            for(const RankedMove &rankedMove : result.rankedMoves)
+                seedPrincipalVariation(gs, rankedMove.principalVariation);
+            seedPrincipalVariation(gs, result.principalVariation);
+        }
+        Score score = 0;
+        size_t bestMoveIndex = 0;
+        bool anyScore = false;
+        for(size_t i = 0; i < rootMoves.size(); i++)
+        {
+            if(progress && iterationDepth == depth)
+                *progress = (float)i / rootMoves.size();
+            auto m = rootMoves[i].move;
+            const GameState childGs = m.apply(gs);
+            context.history.push(childGs, m.isIrreversible(gs));
+            Score v = -evaluateMove(childGs, context, iterationDepth - 1, 1, searchParameters.maxExtensionsPerPath);
+            context.history.pop();
+            if(context.stopped)
+            {
+                result.canceled = true;
+                return result;
+            }
+            rootMoves[i].score = v;
+            if(!anyScore || v > score || (v == score && helperIndex == 0 && rand() % 3 == 0))
+            {
+                anyScore = true;
+                score = v;
+                bestMoveIndex = i;
+            }
+        }
+        assert(anyScore);
+        // search the best move first next iteration, then the rest by score
+        rotate(rootMoves.begin(), rootMoves.begin() + bestMoveIndex, rootMoves.begin() + bestMoveIndex + 1);
+        stable_sort(rootMoves.begin() + 1, rootMoves.end(), [](const RootMove &l, const RootMove &r)
+        {
+            return l.score > r.score;
+        });
+        result.bestMove = rootMoves[0].move;
+        result.score = score;
+        result.depth = iterationDepth;
+        if(helperIndex == 0)
+        {
+            context.flushStatistics();
+            statistics.finishIteration(iterationDepth);
+        }
+        result.principalVariation = getPrincipalVariation(gs, result.bestMove, iterationDepth + searchParameters.maxExtensionsPerPath);
+        // every root move gets an exact score, so the other lines only need their principal variations
+        result.rankedMoves.clear();
+        for(size_t i = 0; i < min(max<size_t>(searchParameters.multiPVCount, 1), rootMoves.size()); i++)
+        {
+            RankedMove rankedMove;
+            rankedMove.move = rootMoves[i].move;
+            rankedMove.score = rootMoves[i].score;
+            rankedMove.depth = iterationDepth;
+            if(i == 0)
+                rankedMove.principalVariation = result.principalVariation;
+            else
+                rankedMove.principalVariation = getPrincipalVariation(gs, rankedMove.move, iterationDepth + searchParameters.maxExtensionsPerPath);
+            result.rankedMoves.push_back(rankedMove);
+        }
+    }
+    if(progress)
+        *progress = 1;
+    return result;
+}
+
+SearchResult GameStateCache::getBestMove(GameState gs, atomic_bool &canceled, int depth, atomic<float> *progress, const GameHistory *history)
 {
     EndCondition endCondition = gs.getEndCondition(*this);
     if(endCondition != EndCondition::Nothing)
     {
         throw InvalidMove();
     }
-    sortValidMoves(gs);
-    const MovesList moves = getValidMoves(gs);
-    assert(moves.size() != 0);
-    float score;
-    size_t bestMoveIndex;
-    bool anyScore = false;
-    for(size_t i = 0; i < moves.size(); i++)
+    GameStateMove bookMove;
+    if(searchParameters.openingBook && searchParameters.openingBook->chooseMove(gs, searchParameters.bookMoveSelection, bookMove))
     {
+        SearchResult result;
+        result.bestMove = bookMove;
+        result.principalVariation.push_back(bookMove);
+        RankedMove rankedMove;
+        rankedMove.move = bookMove;
+        rankedMove.principalVariation = result.principalVariation;
+        result.rankedMoves.push_back(rankedMove);
         if(progress)
-            *progress = (float)i / moves.size();
-        auto m = moves[i];
-        float v = -evaluateMove(m.apply(gs), canceled, depth - 1);
-        if(!anyScore || v > score || (v == score && rand() % 3 == 0))
+            *progress = 1;
+        return result;
+    }
+    transpositionTable->newSearch();
+    liveStatistics.start();
+    SearchResult result = searchWithHelpers(gs, canceled, depth, progress, history);
+    result.statistics = liveStatistics.get();
+    if(searchParameters.statisticsLog)
+    {
+        result.statistics.writeSummary(*searchParameters.statisticsLog);
+        *searchParameters.statisticsLog << endl;
+    }
+    return result;
+}
+
+NeuralAccumulatorCache & GameStateCache::getNeuralAccumulators()
+{
+    if(!neuralAccumulators)
+        neuralAccumulators = make_shared<NeuralAccumulatorCache>();
+    return *neuralAccumulators;
+}
+
+SearchResult GameStateCache::searchWithHelpers(GameState gs, atomic_bool &canceled, int depth, atomic<float> *progress, const GameHistory *history)
+{
+    const size_t helperCount = max<size_t>(searchParameters.threadCount, 1) - 1;
+    while(helperCaches.size() < helperCount)
+        helperCaches.push_back(unique_ptr<GameStateCache>(new GameStateCache(transpositionTable, searchParameters.helperCacheEntryCount)));
+    for(size_t i = 0; i < helperCount; i++)
+        helperCaches[i]->searchParameters = searchParameters;
+    if(helperCount > 0 && searchParameters.parallelSearchMode == ParallelSearchMode::SplitPoints)
+    {
+        vector<GameStateCache *> caches = {this};
+        for(size_t i = 0; i < helperCount; i++)
         {
-            anyScore = true;
-            score = v;
-            bestMoveIndex = i;
+            caches.push_back(helperCaches[i].get());
+            caches.back()->moveOrdering.clearKillers();
+            caches.back()->moveOrdering.ageHistory();
         }
+        ParallelSearch parallel(caches, liveStatistics);
+        return search(gs, canceled, depth, progress, history, 0, liveStatistics, &parallel);
     }
-    assert(anyScore);
-    if(progress)
-        *progress = 1;
-    return moves[bestMoveIndex];
+    // lazy smp: helpers search the same root a little deeper and in a different order, and only
+    // share their work through the transposition table; the result always comes from this thread
+    atomic_bool helpersCanceled(false);
+    vector<thread> helperThreads;
+    for(size_t i = 0; i < helperCount; i++)
+    {
+        GameStateCache *helper = helperCaches[i].get();
+        helperThreads.push_back(thread([this, helper, gs, &helpersCanceled, depth, history, i]()
+        {
+            helper->search(gs, helpersCanceled, depth + 1, nullptr, history, i + 1, liveStatistics);
+        }));
+    }
+    SearchResult result = search(gs, canceled, depth, progress, history, 0, liveStatistics);
+    helpersCanceled = true;
+    for(thread &helperThread : helperThreads)
+        helperThread.join();
+    return result;
 }
 
-void GameStateCache::sortValidMoves(Data & data)
+// moves are searched in the order of their source, best first
+MoveOrderingSource GameStateCache::getMoveOrderingSource(GameState gs, size_t ply, GameStateMove m, uint16_t ttMove) const
+{
+    if(ttMove != 0 && TranspositionTable::encodeMove(m) == ttMove)
+        return MoveOrderingSource::TranspositionTable;
+    if(!m.isQuiet(gs))
+        return gs.getStaticExchangeEvaluation(m) >= 0 ? MoveOrderingSource::Capture : MoveOrderingSource::LosingCapture;
+    if(moveOrdering.getKillerSlot(ply, m) >= 0)
+        return MoveOrderingSource::Killer;
+    return MoveOrderingSource::History;
+}
+
+void GameStateCache::sortValidMoves(Data & data, size_t ply, uint16_t ttMove)
 {
     if(!data.calculated)
         getValidMoves(data.gs);
     data.used = true;
     assert(data.calculated);
-    const GameState & gs = data.gs;
-    sort(data.validMoves.begin(), data.validMoves.end(), [this, &gs, &data](GameStateMove l, GameStateMove r)
-    {
-        GameState lgs = l.apply(gs);
-        Data & ldata = getGameStateEntry(lgs);
-        data.used = true;
-        float lEval = getSortingEvaluation(ldata);
-        GameState rgs = r.apply(gs);
-        Data & rdata = getGameStateEntry(rgs);
-        data.used = true;
-        float rEval = getSortingEvaluation(rdata);
-        return lEval > rEval;
-    });
+    const GameState gs = data.gs;
+    vector<SortingEntry> entries;
+    entries.reserve(data.validMoves.size());
+    for(GameStateMove m : data.validMoves)
+    {
+        const MoveOrderingSource source = getMoveOrderingSource(gs, ply, m, ttMove);
+        switch(source)
+        {
+        case MoveOrderingSource::TranspositionTable:
+            entries.push_back(SortingEntry(m, (int)source, 0));
+            break;
+        case MoveOrderingSource::Capture:
+        case MoveOrderingSource::LosingCapture:
+            entries.push_back(SortingEntry(m, (int)source, getMvvLvaScore(gs, m)));
+            break;
+        case MoveOrderingSource::Killer:
+            entries.push_back(SortingEntry(m, (int)source, -moveOrdering.getKillerSlot(ply, m)));
+            break;
+        case MoveOrderingSource::History:
+            entries.push_back(SortingEntry(m, (int)source, moveOrdering.getHistory(gs.player, m)));
+            break;
+        }
+    }
+    sort(entries.begin(), entries.end());
+    for(size_t i = 0; i < entries.size(); i++)
+        data.validMoves[i] = entries[i].move;
+}
+
+void SearchStatistics::writeSummary(ostream &os) const
+{
+    static const char *const sourceNames[MoveOrderingSourceCount] =
+    {
+        "losingCapture",
+        "history",
+        "killer",
+        "capture",
+        "transpositionTable",
+    };
+    os << "{\"nodes\":" << nodes;
+    os << ",\"quiescenceNodes\":" << quiescenceNodes;
+    os << ",\"seconds\":" << seconds;
+    os << ",\"nodesPerSecond\":" << getNodesPerSecond();
+    os << ",\"depth\":" << depth;
+    os << ",\"selectiveDepth\":" << selectiveDepth;
+    os << ",\"transpositionTableProbes\":" << transpositionTableProbes;
+    os << ",\"transpositionTableHits\":" << transpositionTableHits;
+    os << ",\"transpositionTableCutoffs\":" << transpositionTableCutoffs;
+    os << ",\"tablebaseHits\":" << tablebaseHits;
+    os << ",\"betaCutoffs\":" << betaCutoffs;
+    os << ",\"firstMoveCutoffRate\":" << getFirstMoveCutoffRate();
+    os << ",\"averageCutoffMoveIndex\":" << getAverageCutoffMoveIndex();
+    os << ",\"cutoffsBySource\":{";
+    for(size_t i = 0; i < MoveOrderingSourceCount; i++)
+        os << (i > 0 ? "," : "") << "\"" << sourceNames[i] << "\":" << cutoffsBySource[i];
+    os << "},\"effectiveBranchingFactors\":[";
+    for(size_t i = 1; i < iterationNodes.size(); i++)
+        os << (i > 1 ? "," : "") << getEffectiveBranchingFactor(i);
+    os << "]}";
 }
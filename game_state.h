@@ -13,6 +13,13 @@
 #include <string>
 #include <sstream>
 #include <atomic>
+#include <thread>
+#include <climits>
+#include <algorithm>
+#include <functional>
+#include <deque>
+#include <mutex>
+#include <chrono>
 #include "static_vector.h"
 
 using namespace std;
@@ -69,6 +76,11 @@ struct InvalidMove final : public runtime_error
 
 constexpr size_t BoardSize = 8;
 
+inline size_t getSquareIndex(size_t x, size_t y)
+{
+    return y * BoardSize + x;
+}
+
 inline BoardColor getBoardColor(size_t x, size_t y)
 {
     if((x + y) % 2 == 0)
@@ -262,7 +274,189 @@ inline string getPieceString(PieceType piece, bool useUnicode = true)
     return " ";
 }
 
+// in centipawns
+inline int getPieceValue(PieceType piece)
+{
+    switch(piece)
+    {
+    case PieceType::Empty:
+        return 0;
+    case PieceType::WhitePawn:
+    case PieceType::BlackPawn:
+        return 100;
+    case PieceType::WhiteRook:
+    case PieceType::BlackRook:
+        return 500;
+    case PieceType::WhiteKnight:
+    case PieceType::BlackKnight:
+        return 300;
+    case PieceType::WhiteBishop:
+    case PieceType::BlackBishop:
+        return 300;
+    case PieceType::WhiteQueen:
+    case PieceType::BlackQueen:
+        return 900;
+    case PieceType::WhiteKing:
+    case PieceType::BlackKing:
+        return 100000;
+    }
+    assert(false);
+    return 0;
+}
+
+// search scores in centipawns from the side to move's point of view
+typedef int16_t Score;
+constexpr Score MateScore = 32000;
+constexpr Score MaxMatePly = 1000;
+
+// mate scores count the plies to mate from the root so shorter mates score higher
+inline Score getMateScore(size_t ply)
+{
+    return MateScore - (Score)ply;
+}
+
+inline Score getMatedScore(size_t ply)
+{
+    return -MateScore + (Score)ply;
+}
+
+inline bool isMateScore(int score)
+{
+    return score >= MateScore - MaxMatePly || score <= -(MateScore - MaxMatePly);
+}
+
+// known wins that aren't mates yet, like tablebase wins; also counted from the root
+constexpr Score TablebaseWinScore = MateScore - MaxMatePly - 1;
+
+// mates and known wins
+inline bool isDecisiveScore(int score)
+{
+    return score >= TablebaseWinScore - MaxMatePly || score <= -(TablebaseWinScore - MaxMatePly);
+}
+
+// cached mate scores are stored relative to the cached position instead of the root
+inline Score scoreToCache(Score score, size_t ply)
+{
+    if(score >= TablebaseWinScore - MaxMatePly)
+        return score + (Score)ply;
+    if(score <= -(TablebaseWinScore - MaxMatePly))
+        return score - (Score)ply;
+    return score;
+}
+
+inline Score scoreFromCache(Score score, size_t ply)
+{
+    if(score >= TablebaseWinScore - MaxMatePly)
+        return score - (Score)ply;
+    if(score <= -(TablebaseWinScore - MaxMatePly))
+        return score + (Score)ply;
+    return score;
+}
+
+struct ZobristKeys final
+{
+    array<array<uint64_t, PieceTypeCount>, BoardSize * BoardSize> pieces;
+    uint64_t blackToMove;
+    uint64_t blackCanCastleLeft, blackCanCastleRight, whiteCanCastleLeft, whiteCanCastleRight;
+    array<array<uint64_t, BoardSize>, BoardSize> enpassantCapture;
+    ZobristKeys()
+    {
+        uint64_t state = 0x9E3779B97F4A7C15ULL;
+        auto next = [&state]()
+        {
+            // splitmix64
+            uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            return z ^ (z >> 31);
+        };
+        for(auto & square : pieces)
+        {
+            for(uint64_t & v : square)
+                v = next();
+        }
+        blackToMove = next();
+        blackCanCastleLeft = next();
+        blackCanCastleRight = next();
+        whiteCanCastleLeft = next();
+        whiteCanCastleRight = next();
+        for(auto & column : enpassantCapture)
+        {
+            for(uint64_t & v : column)
+                v = next();
+        }
+    }
+};
+
+inline const ZobristKeys & getZobristKeys()
+{
+    static const ZobristKeys keys;
+    return keys;
+}
+
+// a middlegame and an endgame score, blended by how much material is left
+struct TaperedScore final
+{
+    int16_t middlegame, endgame;
+    TaperedScore & operator +=(TaperedScore r)
+    {
+        middlegame += r.middlegame;
+        endgame += r.endgame;
+        return *this;
+    }
+    TaperedScore & operator -=(TaperedScore r)
+    {
+        middlegame -= r.middlegame;
+        endgame -= r.endgame;
+        return *this;
+    }
+};
+
+constexpr size_t PieceKindCount = 6;
+constexpr int MaxGamePhase = 24; // all the knights, bishops, rooks and queens are on the board
+
+// indexed by the piece without its color, in the order of PieceType
+extern const array<TaperedScore, PieceKindCount> pieceValues;
+extern const array<int, PieceKindCount> piecePhases;
+// from white's side with rank 8 first, like a printed board
+extern const array<array<int16_t, BoardSize * BoardSize>, PieceKindCount> middlegamePieceSquareBonuses;
+extern const array<array<int16_t, BoardSize * BoardSize>, PieceKindCount> endgamePieceSquareBonuses;
+
+inline size_t getPieceKind(PieceType piece)
+{
+    assert(piece != PieceType::Empty);
+    return ((size_t)piece - 1) % PieceKindCount;
+}
+
+// the material and square bonus of piece on (x, y), negative for black pieces
+inline TaperedScore getPieceSquareValue(PieceType piece, size_t x, size_t y)
+{
+    const size_t kind = getPieceKind(piece);
+    const bool isWhite = (getPieceColor(piece) == PieceColor::White);
+    const size_t square = getSquareIndex(x, isWhite ? BoardSize - 1 - y : y);
+    TaperedScore retval = pieceValues[kind];
+    retval.middlegame += middlegamePieceSquareBonuses[kind][square];
+    retval.endgame += endgamePieceSquareBonuses[kind][square];
+    if(!isWhite)
+    {
+        retval.middlegame = -retval.middlegame;
+        retval.endgame = -retval.endgame;
+    }
+    return retval;
+}
+
+inline int getTaperedValue(TaperedScore score, int phase)
+{
+    phase = min(phase, MaxGamePhase);
+    return (score.middlegame * phase + score.endgame * (MaxGamePhase - phase)) / MaxGamePhase;
+}
+
 struct GameStateCache;
+struct GameStateMove;
+class Tablebase;
+class OpeningBook;
+class NeuralNetwork;
+class NeuralAccumulatorCache;
 
 struct GameState final
 {
@@ -310,8 +504,49 @@ struct GameState final
         retval.board[6][7] = PieceType::BlackKnight;
         retval.board[7][7] = PieceType::BlackRook;
         retval.player = Player::White;
+        retval.recalculateMaterial();
         return retval;
     }
+private:
+    TaperedScore pieceSquareScore = {0, 0}; // white's material and square bonuses minus black's
+    array<uint8_t, PieceTypeCount> pieceCounts = {{}};
+    uint64_t pieceHash = 0; // the zobrist keys of the pieces, the rest of getHash is added when asked for
+public:
+    // keeps the material and the hash up to date; moves change the board through it
+    inline void setSquare(size_t x, size_t y, PieceType piece)
+    {
+        PieceType &square = board[x][y];
+        const ZobristKeys & keys = getZobristKeys();
+        if(square != PieceType::Empty)
+        {
+            pieceSquareScore -= getPieceSquareValue(square, x, y);
+            pieceCounts[(size_t)square]--;
+            pieceHash ^= keys.pieces[getSquareIndex(x, y)][(size_t)square];
+        }
+        square = piece;
+        if(piece != PieceType::Empty)
+        {
+            pieceSquareScore += getPieceSquareValue(piece, x, y);
+            pieceCounts[(size_t)piece]++;
+            pieceHash ^= keys.pieces[getSquareIndex(x, y)][(size_t)piece];
+        }
+    }
+    void recalculateMaterial(); // after writing to board directly
+    inline TaperedScore getPieceSquareScore() const
+    {
+        return pieceSquareScore;
+    }
+    inline size_t getPieceCount(PieceType piece) const
+    {
+        return pieceCounts[(size_t)piece];
+    }
+    inline int getGamePhase() const // MaxGamePhase at the start down to 0 with only pawns and kings
+    {
+        int retval = 0;
+        for(size_t piece = 1; piece < PieceTypeCount; piece++)
+            retval += piecePhases[getPieceKind((PieceType)piece)] * pieceCounts[piece];
+        return min(retval, MaxGamePhase);
+    }
     friend bool operator ==(const GameState &l, const GameState &r)
     {
         for(size_t x = 0; x < BoardSize; x++)
@@ -354,14 +589,16 @@ public:
         return endCondition;
     }
 private:
-    float staticEvaluation;
+    Score staticEvaluation;
     bool staticEvaluationSet = false;
-    void calcStaticEvaluation(GameStateCache &cache);
+    Score evaluate(GameStateCache &cache, Score worstValue, Score bestValue, bool &exact);
+    void calcStaticEvaluation(GameStateCache &cache, Score worstValue, Score bestValue);
 public:
-    inline float getStaticEvaluation(GameStateCache &cache)
+    // outside the window from worstValue to bestValue the score may be lazy: on the right side of the window but not exact
+    inline Score getStaticEvaluation(GameStateCache &cache, Score worstValue = -MateScore, Score bestValue = MateScore)
     {
         //if(!staticEvaluationSet)
-            calcStaticEvaluation(cache);
+            calcStaticEvaluation(cache, worstValue, bestValue);
         return staticEvaluation;
     }
 private:
@@ -377,11 +614,16 @@ public:
         return isPositionAttacked(x, y, player);
     }
     bool isKingAttacked(Player side) const;
+    bool isTieByMaterial() const; // neither side has enough material to mate
+    bool canCaptureEnpassant() const; // not just whether the last move was a double pawn move
     inline bool isKingAttacked() const
     {
         return isKingAttacked(player);
     }
+    bool getLeastValuableAttacker(size_t x, size_t y, PieceColor attackerColor, size_t &attackerX, size_t &attackerY) const;
+    int getStaticExchangeEvaluation(GameStateMove m) const;
     void drawChessBoard(GameStateCache &cache, bool useUnicode = true, bool moveToHome = true, int startX = -1, int startY = -1, int endX = -1, int endY = -1) const;
+    uint64_t getHash() const; // zobrist hash of everything compared by operator ==
 };
 
 namespace std
@@ -419,6 +661,10 @@ struct GameStateMove final
     unsigned endX : 4, endY : 4;
     unsigned captureX : 4, captureY : 4;
     PieceType promoteToType;
+    GameStateMove()
+        : startX(0), startY(0), endX(0), endY(0), captureX(0), captureY(0), promoteToType(PieceType::Empty)
+    {
+    }
     GameStateMove(size_t startX, size_t startY, size_t endX, size_t endY, size_t captureX, size_t captureY, PieceType promoteToType = PieceType::Empty)
         : startX(startX), startY(startY), endX(endX), endY(endY), captureX(captureX), captureY(captureY), promoteToType(promoteToType)
     {
@@ -433,6 +679,31 @@ struct GameStateMove final
         : GameStateMove(startX, startY, endX, endY, endX, endY, promoteToType)
     {
     }
+    friend bool operator ==(GameStateMove l, GameStateMove r)
+    {
+        return l.startX == r.startX && l.startY == r.startY && l.endX == r.endX && l.endY == r.endY && l.captureX == r.captureX && l.captureY == r.captureY && l.promoteToType == r.promoteToType;
+    }
+    friend bool operator !=(GameStateMove l, GameStateMove r)
+    {
+        return !operator ==(l, r);
+    }
+    inline bool isNull() const
+    {
+        return startX == endX && startY == endY;
+    }
+    inline bool isCapture(const GameState &gs) const
+    {
+        return gs.board[captureX][captureY] != PieceType::Empty;
+    }
+    inline bool isQuiet(const GameState &gs) const
+    {
+        return !isCapture(gs) && promoteToType == PieceType::Empty;
+    }
+    // captures and pawn moves reset the fifty-move counter, and no earlier position can repeat after them
+    inline bool isIrreversible(const GameState &gs) const
+    {
+        return isCapture(gs) || gs.board[startX][startY] == PieceType::WhitePawn || gs.board[startX][startY] == PieceType::BlackPawn;
+    }
     inline GameState apply(GameState gs) const
     {
         PieceType destType = promoteToType;
@@ -440,28 +711,28 @@ struct GameStateMove final
             destType = gs.board[startX][startY];
         gs.enpassantCaptureX = 0;
         gs.enpassantCaptureY = 0;
-        gs.board[startX][startY] = PieceType::Empty;
-        gs.board[captureX][captureY] = PieceType::Empty;
-        gs.board[endX][endY] = destType;
+        gs.setSquare(startX, startY, PieceType::Empty);
+        gs.setSquare(captureX, captureY, PieceType::Empty);
+        gs.setSquare(endX, endY, destType);
         if(destType == PieceType::BlackKing && startX == 4 && startY == 7 && gs.blackCanCastleLeft && endX == 2 && endY == 7)
         {
-            gs.board[3][7] = gs.board[0][7];
-            gs.board[0][7] = PieceType::Empty;
+            gs.setSquare(3, 7, gs.board[0][7]);
+            gs.setSquare(0, 7, PieceType::Empty);
         }
         else if(destType == PieceType::BlackKing && startX == 4 && startY == 7 && gs.blackCanCastleRight && endX == 6 && endY == 7)
         {
-            gs.board[5][7] = gs.board[7][7];
-            gs.board[7][7] = PieceType::Empty;
+            gs.setSquare(5, 7, gs.board[7][7]);
+            gs.setSquare(7, 7, PieceType::Empty);
         }
         else if(destType == PieceType::WhiteKing && startX == 4 && startY == 0 && gs.whiteCanCastleLeft && endX == 2 && endY == 0)
         {
-            gs.board[3][0] = gs.board[0][0];
-            gs.board[0][0] = PieceType::Empty;
+            gs.setSquare(3, 0, gs.board[0][0]);
+            gs.setSquare(0, 0, PieceType::Empty);
         }
         else if(destType == PieceType::WhiteKing && startX == 4 && startY == 0 && gs.whiteCanCastleRight && endX == 6 && endY == 0)
         {
-            gs.board[5][0] = gs.board[7][0];
-            gs.board[7][0] = PieceType::Empty;
+            gs.setSquare(5, 0, gs.board[7][0]);
+            gs.setSquare(7, 0, PieceType::Empty);
         }
         if(destType == PieceType::BlackKing)
         {
@@ -531,46 +802,681 @@ struct GameStateMove final
     }
 };
 
-class GameStateCache final
+class GameHistory final
 {
-    static constexpr size_t maxMovesPerRook = 14;
-    static constexpr size_t maxMovesPerKnight = 8;
-    static constexpr size_t maxMovesPerBishop = 15;
-    static constexpr size_t maxMovesPerQueen = maxMovesPerRook + maxMovesPerBishop;
-    static constexpr size_t maxMovesPerPawn = maxMovesPerQueen; // after they have been promoted
-    static constexpr size_t maxMovesPerKing = 8; // only 5 other moves when we can castle
+    struct Entry final
+    {
+        uint64_t hash;
+        unsigned halfmoveClock;
+    };
+    vector<Entry> entries;
 public:
-    static constexpr size_t maxMoves = maxMovesPerPawn * 8 + maxMovesPerRook * 2 + maxMovesPerKnight * 2 + maxMovesPerBishop * 2 + maxMovesPerQueen + maxMovesPerKing;
-    typedef vector<GameStateMove> MovesList;
-    const MovesList & getValidMoves(GameState gs);
+    void clear()
+    {
+        entries.clear();
+    }
+    bool empty() const
+    {
+        return entries.empty();
+    }
+    // irreversible is whether the move that reached gs was a capture or a pawn move
+    void push(const GameState &gs, bool irreversible)
+    {
+        Entry entry;
+        entry.hash = gs.getHash();
+        entry.halfmoveClock = (irreversible || entries.empty()) ? 0 : entries.back().halfmoveClock + 1;
+        entries.push_back(entry);
+    }
+    void pop()
+    {
+        assert(!entries.empty());
+        entries.pop_back();
+    }
+    uint64_t getHash() const
+    {
+        assert(!entries.empty());
+        return entries.back().hash;
+    }
+    unsigned getHalfmoveClock() const
+    {
+        if(entries.empty())
+            return 0;
+        return entries.back().halfmoveClock;
+    }
+    // returns how many plies ago the current position last occurred or 0 if it didn't since the last irreversible move
+    size_t findRepetition() const
+    {
+        if(entries.empty())
+            return 0;
+        const Entry &current = entries.back();
+        const size_t limit = min<size_t>(current.halfmoveClock, entries.size() - 1);
+        for(size_t distance = 4; distance <= limit; distance += 2)
+        {
+            if(entries[entries.size() - 1 - distance].hash == current.hash)
+                return distance;
+        }
+        return 0;
+    }
+    size_t getRepetitionCount() const
+    {
+        size_t retval = 1;
+        if(entries.empty())
+            return retval;
+        const Entry &current = entries.back();
+        const size_t limit = min<size_t>(current.halfmoveClock, entries.size() - 1);
+        for(size_t distance = 4; distance <= limit; distance += 2)
+        {
+            if(entries[entries.size() - 1 - distance].hash == current.hash)
+                retval++;
+        }
+        return retval;
+    }
+    static constexpr unsigned fiftyMoveRuleHalfmoves = 100;
+    bool isFiftyMoveRuleDraw() const
+    {
+        return getHalfmoveClock() >= fiftyMoveRuleHalfmoves;
+    }
+};
+
+class MoveOrderingHeuristics final
+{
+public:
+    static constexpr size_t maxPly = 64;
+    static constexpr size_t killersPerPly = 2;
 private:
-    struct EvaluationEntry final
+    static constexpr int32_t maxHistoryValue = 1 << 24;
+    array<array<GameStateMove, killersPerPly>, maxPly> killers;
+    array<array<array<int32_t, BoardSize * BoardSize>, BoardSize * BoardSize>, 2> history; // [player][from][to]
+public:
+    MoveOrderingHeuristics()
+    {
+        clear();
+    }
+    void clearKillers()
+    {
+        for(auto & plyKillers : killers)
+        {
+            for(GameStateMove & m : plyKillers)
+                m = GameStateMove();
+        }
+    }
+    void clearHistory()
+    {
+        for(auto & playerHistory : history)
+        {
+            for(auto & fromHistory : playerHistory)
+            {
+                for(int32_t & v : fromHistory)
+                    v = 0;
+            }
+        }
+    }
+    void clear()
+    {
+        clearKillers();
+        clearHistory();
+    }
+    void ageHistory(unsigned shift = 1)
+    {
+        for(auto & playerHistory : history)
+        {
+            for(auto & fromHistory : playerHistory)
+            {
+                for(int32_t & v : fromHistory)
+                    v >>= shift;
+            }
+        }
+    }
+    // returns the killer slot the move is in or -1 if it isn't a killer
+    int getKillerSlot(size_t ply, GameStateMove m) const
+    {
+        if(ply >= maxPly || m.isNull())
+            return -1;
+        for(size_t i = 0; i < killersPerPly; i++)
+        {
+            if(killers[ply][i] == m)
+                return (int)i;
+        }
+        return -1;
+    }
+    void addKiller(size_t ply, GameStateMove m)
+    {
+        if(ply >= maxPly || killers[ply][0] == m)
+            return;
+        for(size_t i = killersPerPly - 1; i > 0; i--)
+            killers[ply][i] = killers[ply][i - 1];
+        killers[ply][0] = m;
+    }
+    int32_t getHistory(Player player, GameStateMove m) const
+    {
+        return history[(size_t)player][getSquareIndex(m.startX, m.startY)][getSquareIndex(m.endX, m.endY)];
+    }
+    void addHistory(Player player, GameStateMove m, int depth)
+    {
+        int32_t & v = history[(size_t)player][getSquareIndex(m.startX, m.startY)][getSquareIndex(m.endX, m.endY)];
+        v += depth * depth;
+        if(v > maxHistoryValue)
+            ageHistory();
+    }
+};
+
+// lock-free: entries are written without locking and a torn entry just fails its key check
+class TranspositionTable final
+{
+public:
+    static constexpr Score noLowerBound = INT16_MIN;
+    static constexpr Score noUpperBound = INT16_MAX;
+    struct Entry final
+    {
+        Score lowerBound = noLowerBound;
+        Score upperBound = noUpperBound;
+        uint8_t depth = 0;
+        uint8_t generation = 0;
+        uint16_t move = 0; // from encodeMove
+        bool hasLowerBound() const
+        {
+            return lowerBound != noLowerBound;
+        }
+        bool hasUpperBound() const
+        {
+            return upperBound != noUpperBound;
+        }
+    };
+    // 0 means no move
+    static uint16_t encodeMove(GameStateMove m)
+    {
+        if(m.isNull())
+            return 0;
+        unsigned promotion = 0;
+        switch(setPieceColor(m.promoteToType, PieceColor::White))
+        {
+        case PieceType::WhiteKnight:
+            promotion = 1;
+            break;
+        case PieceType::WhiteBishop:
+            promotion = 2;
+            break;
+        case PieceType::WhiteRook:
+            promotion = 3;
+            break;
+        case PieceType::WhiteQueen:
+            promotion = 4;
+            break;
+        default:
+            break;
+        }
+        return (uint16_t)(getSquareIndex(m.startX, m.startY) | getSquareIndex(m.endX, m.endY) << 6 | promotion << 12);
+    }
+private:
+    struct Slot final
+    {
+        atomic<uint64_t> check; // key ^ data
+        atomic<uint64_t> data;
+    };
+    unique_ptr<Slot[]> slots;
+    const size_t mask;
+    atomic<unsigned> generation;
+    static uint64_t pack(const Entry &entry)
+    {
+        return (uint64_t)(uint16_t)entry.lowerBound | (uint64_t)(uint16_t)entry.upperBound << 16 | (uint64_t)entry.depth << 32 | (uint64_t)entry.generation << 40 | (uint64_t)entry.move << 48;
+    }
+    static Entry unpack(uint64_t data)
     {
-        float minValue;
-        float maxValue;
-        bool haveMin = false;
-        bool haveMax = false;
-        EvaluationEntry()
+        Entry retval;
+        retval.lowerBound = (Score)(uint16_t)data;
+        retval.upperBound = (Score)(uint16_t)(data >> 16);
+        retval.depth = (uint8_t)(data >> 32);
+        retval.generation = (uint8_t)(data >> 40);
+        retval.move = (uint16_t)(data >> 48);
+        return retval;
+    }
+    void write(uint64_t key, const Entry &entry)
+    {
+        Slot &slot = slots[key & mask];
+        const uint64_t data = pack(entry);
+        slot.check.store(key ^ data, memory_order_relaxed);
+        slot.data.store(data, memory_order_relaxed);
+    }
+public:
+    explicit TranspositionTable(unsigned sizeLog2 = 20)
+        : slots(new Slot[(size_t)1 << sizeLog2]), mask(((size_t)1 << sizeLog2) - 1), generation(0)
+    {
+        clear();
+    }
+    void clear()
+    {
+        for(size_t i = 0; i <= mask; i++)
         {
+            slots[i].check.store(0, memory_order_relaxed);
+            slots[i].data.store(0, memory_order_relaxed);
         }
-        EvaluationEntry(float v)
-            : minValue(v), maxValue(v), haveMin(true), haveMax(true)
+    }
+    // call before each search so entries from older searches are replaced first
+    void newSearch()
+    {
+        generation++;
+    }
+    size_t size() const
+    {
+        return mask + 1;
+    }
+    bool probe(uint64_t key, Entry &entry) const
+    {
+        const Slot &slot = slots[key & mask];
+        const uint64_t data = slot.data.load(memory_order_relaxed);
+        const uint64_t check = slot.check.load(memory_order_relaxed);
+        if((check ^ data) != key || data == 0)
+            return false;
+        entry = unpack(data);
+        return true;
+    }
+    // bounds from a search of the same depth are merged; a move of 0 keeps the old move
+    void store(uint64_t key, int depth, Score lowerBound, Score upperBound, uint16_t move)
+    {
+        Entry entry;
+        entry.depth = (uint8_t)min(max(depth, 0), 255);
+        entry.generation = (uint8_t)generation.load(memory_order_relaxed);
+        Entry old;
+        if(probe(key, old))
         {
+            if(old.depth > entry.depth)
+            {
+                if(move != 0 && move != old.move)
+                {
+                    old.move = move;
+                    old.generation = entry.generation;
+                    write(key, old);
+                }
+                return;
+            }
+            if(old.depth == entry.depth)
+            {
+                lowerBound = max(lowerBound, old.lowerBound);
+                upperBound = min(upperBound, old.upperBound);
+            }
+            if(move == 0)
+                move = old.move;
         }
-        inline float getAverage() const
+        else
         {
-            assert(haveMin || haveMax);
-            if(haveMin && haveMax)
-                return 0.5f * (minValue + maxValue);
-            if(haveMin)
-                return minValue;
-            return maxValue;
+            const Entry replaced = unpack(slots[key & mask].data.load(memory_order_relaxed));
+            if(replaced.generation == entry.generation && replaced.depth > entry.depth)
+                return;
         }
-        inline bool hasAnyData() const
+        entry.lowerBound = lowerBound;
+        entry.upperBound = upperBound;
+        entry.move = move;
+        write(key, entry);
+    }
+    void storeMove(uint64_t key, uint16_t move)
+    {
+        Entry entry;
+        if(probe(key, entry))
         {
-            return haveMin || haveMax;
+            entry.move = move;
+            write(key, entry);
+            return;
         }
+        store(key, 0, noLowerBound, noUpperBound, move);
+    }
+};
+
+// static evaluations by position; each GameStateCache has its own, so unlike the transposition table it needs no atomics
+class EvaluationCache final
+{
+    struct Slot final
+    {
+        uint16_t check = 0; // the top bits of the key, never 0 in a used slot
+        Score score = 0;
     };
+    unique_ptr<Slot[]> slots;
+    const size_t mask;
+    static uint16_t getCheck(uint64_t key)
+    {
+        return max<uint16_t>((uint16_t)(key >> 48), 1);
+    }
+public:
+    explicit EvaluationCache(unsigned sizeLog2 = 16)
+        : slots(new Slot[(size_t)1 << sizeLog2]), mask(((size_t)1 << sizeLog2) - 1)
+    {
+    }
+    void clear()
+    {
+        for(size_t i = 0; i <= mask; i++)
+            slots[i] = Slot();
+    }
+    bool probe(uint64_t key, Score &score) const
+    {
+        const Slot &slot = slots[key & mask];
+        if(slot.check != getCheck(key))
+            return false;
+        score = slot.score;
+        return true;
+    }
+    void store(uint64_t key, Score score)
+    {
+        Slot &slot = slots[key & mask];
+        slot.check = getCheck(key);
+        slot.score = score;
+    }
+};
+
+// each worker has its own deque: it pushes and pops at the back and idle workers steal the oldest task from the front
+class WorkStealingScheduler final
+{
+public:
+    typedef function<void(size_t workerIndex)> TaskFunction;
+private:
+    struct Task final
+    {
+        TaskFunction fn;
+        const void *tag; // lets a worker wait for just its own tasks
+    };
+    struct WorkerQueue final
+    {
+        mutex lock;
+        deque<Task> tasks;
+    };
+    vector<unique_ptr<WorkerQueue>> queues;
+    vector<thread> threads;
+    atomic_bool done;
+    bool pop(size_t workerIndex, const void *tag, Task &task)
+    {
+        WorkerQueue &queue = *queues[workerIndex];
+        lock_guard<mutex> lockIt(queue.lock);
+        if(queue.tasks.empty() || (tag != nullptr && queue.tasks.back().tag != tag))
+            return false;
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        return true;
+    }
+    bool steal(size_t thiefIndex, Task &task)
+    {
+        for(size_t i = 1; i < queues.size(); i++)
+        {
+            WorkerQueue &queue = *queues[(thiefIndex + i) % queues.size()];
+            lock_guard<mutex> lockIt(queue.lock);
+            if(queue.tasks.empty())
+                continue;
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            return true;
+        }
+        return false;
+    }
+public:
+    // worker 0 is the thread that creates the scheduler, the others get their own threads
+    explicit WorkStealingScheduler(size_t workerCount)
+        : done(false)
+    {
+        workerCount = max<size_t>(workerCount, 1);
+        for(size_t i = 0; i < workerCount; i++)
+            queues.push_back(unique_ptr<WorkerQueue>(new WorkerQueue));
+        for(size_t i = 1; i < workerCount; i++)
+        {
+            threads.push_back(thread([this, i]()
+            {
+                while(!done)
+                {
+                    if(!runTask(i))
+                        this_thread::yield();
+                }
+            }));
+        }
+    }
+    WorkStealingScheduler(const WorkStealingScheduler &) = delete;
+    const WorkStealingScheduler & operator =(const WorkStealingScheduler &) = delete;
+    ~WorkStealingScheduler()
+    {
+        done = true;
+        for(thread &t : threads)
+            t.join();
+    }
+    size_t getWorkerCount() const
+    {
+        return queues.size();
+    }
+    void push(size_t workerIndex, TaskFunction fn, const void *tag)
+    {
+        WorkerQueue &queue = *queues[workerIndex];
+        lock_guard<mutex> lockIt(queue.lock);
+        queue.tasks.push_back(Task{std::move(fn), tag});
+    }
+    // runs the newest task of workerIndex if it has the given tag
+    bool runOwnTask(size_t workerIndex, const void *tag)
+    {
+        Task task;
+        if(!pop(workerIndex, tag, task))
+            return false;
+        task.fn(workerIndex);
+        return true;
+    }
+    // runs one of workerIndex's own tasks or steals one
+    bool runTask(size_t workerIndex)
+    {
+        Task task;
+        if(!pop(workerIndex, nullptr, task) && !steal(workerIndex, task))
+            return false;
+        task.fn(workerIndex);
+        return true;
+    }
+};
+
+enum class ParallelSearchMode
+{
+    LazySmp,
+    SplitPoints
+};
+
+enum class BookMoveSelection
+{
+    WeightedRandom, // picked with a probability proportional to its weight
+    BestWeight
+};
+
+struct SearchParameters final
+{
+    // indexed by the remaining depth; pruning is only tried at depths inside the array
+    array<Score, 3> futilityMargins = {{0, 125, 300}};
+    array<Score, 3> razoringMargins = {{0, 300, 500}};
+    int maxExtensionsPerPath = 4;
+    bool checkExtensions = true;
+    bool singleReplyExtensions = true;
+    int singularExtensionMinDepth = 3;
+    Score singularMargin = 50;
+    size_t cancelCheckNodeInterval = 1024; // bounds how many nodes a search runs after being canceled
+    size_t threadCount = 1;
+    // LazySmp: the extra threads search the same tree and share the transposition table
+    // SplitPoints: once the first move of a node is searched the other moves are shared with idle threads
+    ParallelSearchMode parallelSearchMode = ParallelSearchMode::LazySmp;
+    int minSplitDepth = 3;
+    size_t multiPVCount = 1; // how many of the best root moves are returned in SearchResult::rankedMoves
+    shared_ptr<const Tablebase> tablebase; // probed when a capture or pawn move reaches a position in it
+    shared_ptr<const OpeningBook> openingBook; // consulted before searching
+    BookMoveSelection bookMoveSelection = BookMoveSelection::WeightedRandom;
+    shared_ptr<const NeuralNetwork> neuralNetwork; // evaluates instead of the piece-square tables when set
+    // mobility and king safety are skipped when the material and piece-square score is further outside the window
+    // than MaxMobilityAndKingSafety, so the lazy score always lands on the same side of the window as the full one
+    bool lazyEvaluation = true;
+    ostream *statisticsLog = nullptr; // if set, a json summary of each search's statistics is written as a line
+    size_t helperCacheEntryCount = 200000;
+};
+
+// the order moves are searched in; the values are the sorting categories, best last
+enum class MoveOrderingSource
+{
+    LosingCapture,
+    History,
+    Killer,
+    Capture,
+    TranspositionTable
+};
+
+constexpr size_t MoveOrderingSourceCount = 5;
+
+struct SearchStatistics final
+{
+    uint64_t nodes = 0; // including the quiescence nodes
+    uint64_t quiescenceNodes = 0;
+    uint64_t transpositionTableProbes = 0;
+    uint64_t transpositionTableHits = 0;
+    uint64_t transpositionTableCutoffs = 0;
+    uint64_t tablebaseHits = 0;
+    uint64_t betaCutoffs = 0; // not counting the quiescence search
+    uint64_t firstMoveCutoffs = 0;
+    uint64_t cutoffMoveIndexSum = 0; // the index in the sorted moves
+    array<uint64_t, MoveOrderingSourceCount> cutoffsBySource = {{}};
+    vector<uint64_t> iterationNodes; // the total node count after each completed iteration
+    int depth = 0; // of the last completed iteration
+    int selectiveDepth = 0; // the deepest ply reached, counting extensions and the quiescence search
+    double seconds = 0;
+    double getNodesPerSecond() const
+    {
+        return seconds > 0 ? nodes / seconds : 0;
+    }
+    double getFirstMoveCutoffRate() const
+    {
+        return betaCutoffs > 0 ? (double)firstMoveCutoffs / betaCutoffs : 0;
+    }
+    double getAverageCutoffMoveIndex() const
+    {
+        return betaCutoffs > 0 ? (double)cutoffMoveIndexSum / betaCutoffs : 0;
+    }
+    // the nodes of an iteration divided by the nodes of the one before it
+    double getEffectiveBranchingFactor(size_t iteration) const
+    {
+        if(iteration == 0 || iteration >= iterationNodes.size())
+            return 0;
+        uint64_t previousNodes = iterationNodes[iteration - 1] - (iteration >= 2 ? iterationNodes[iteration - 2] : 0);
+        uint64_t currentNodes = iterationNodes[iteration] - iterationNodes[iteration - 1];
+        return previousNodes > 0 ? (double)currentNodes / previousNodes : 0;
+    }
+    // writes a single line of json
+    void writeSummary(ostream &os) const;
+};
+
+// the searching threads add their counts in batches so this can be read while a search is running
+class LiveSearchStatistics final
+{
+    atomic<uint64_t> nodes, quiescenceNodes, transpositionTableProbes, transpositionTableHits, transpositionTableCutoffs, betaCutoffs;
+    atomic<uint64_t> tablebaseHits, firstMoveCutoffs, cutoffMoveIndexSum;
+    array<atomic<uint64_t>, MoveOrderingSourceCount> cutoffsBySource;
+    atomic_int depth, selectiveDepth;
+    atomic<int64_t> startTime; // steady_clock ticks
+    mutable mutex iterationNodesLock;
+    vector<uint64_t> iterationNodes;
+public:
+    LiveSearchStatistics()
+    {
+        start();
+    }
+    void start()
+    {
+        nodes = 0;
+        quiescenceNodes = 0;
+        transpositionTableProbes = 0;
+        transpositionTableHits = 0;
+        transpositionTableCutoffs = 0;
+        betaCutoffs = 0;
+        tablebaseHits = 0;
+        firstMoveCutoffs = 0;
+        cutoffMoveIndexSum = 0;
+        for(atomic<uint64_t> &count : cutoffsBySource)
+            count = 0;
+        depth = 0;
+        selectiveDepth = 0;
+        {
+            lock_guard<mutex> lockIt(iterationNodesLock);
+            iterationNodes.clear();
+        }
+        startTime = chrono::steady_clock::now().time_since_epoch().count();
+    }
+    void add(const SearchStatistics &counts)
+    {
+        nodes += counts.nodes;
+        quiescenceNodes += counts.quiescenceNodes;
+        transpositionTableProbes += counts.transpositionTableProbes;
+        transpositionTableHits += counts.transpositionTableHits;
+        transpositionTableCutoffs += counts.transpositionTableCutoffs;
+        betaCutoffs += counts.betaCutoffs;
+        tablebaseHits += counts.tablebaseHits;
+        firstMoveCutoffs += counts.firstMoveCutoffs;
+        cutoffMoveIndexSum += counts.cutoffMoveIndexSum;
+        for(size_t i = 0; i < MoveOrderingSourceCount; i++)
+            cutoffsBySource[i] += counts.cutoffsBySource[i];
+        int oldSelectiveDepth = selectiveDepth;
+        while(oldSelectiveDepth < counts.selectiveDepth && !selectiveDepth.compare_exchange_weak(oldSelectiveDepth, counts.selectiveDepth))
+        {
+        }
+    }
+    // node counts of other threads that haven't been added yet are counted in the next iteration
+    void finishIteration(int depth)
+    {
+        this->depth = depth;
+        lock_guard<mutex> lockIt(iterationNodesLock);
+        iterationNodes.push_back(nodes);
+    }
+    SearchStatistics get() const
+    {
+        SearchStatistics retval;
+        retval.nodes = nodes;
+        retval.quiescenceNodes = quiescenceNodes;
+        retval.transpositionTableProbes = transpositionTableProbes;
+        retval.transpositionTableHits = transpositionTableHits;
+        retval.transpositionTableCutoffs = transpositionTableCutoffs;
+        retval.betaCutoffs = betaCutoffs;
+        retval.tablebaseHits = tablebaseHits;
+        retval.firstMoveCutoffs = firstMoveCutoffs;
+        retval.cutoffMoveIndexSum = cutoffMoveIndexSum;
+        for(size_t i = 0; i < MoveOrderingSourceCount; i++)
+            retval.cutoffsBySource[i] = cutoffsBySource[i];
+        {
+            lock_guard<mutex> lockIt(iterationNodesLock);
+            retval.iterationNodes = iterationNodes;
+        }
+        retval.depth = depth;
+        retval.selectiveDepth = selectiveDepth;
+        chrono::steady_clock::duration elapsed = chrono::steady_clock::now().time_since_epoch() - chrono::steady_clock::duration(startTime);
+        retval.seconds = chrono::duration<double>(elapsed).count();
+        return retval;
+    }
+};
+
+struct RankedMove final
+{
+    GameStateMove move;
+    vector<GameStateMove> principalVariation; // starts with move
+    Score score = 0; // exact
+    int depth = 0;
+};
+
+struct SearchResult final
+{
+    GameStateMove bestMove;
+    vector<GameStateMove> principalVariation; // starts with bestMove
+    Score score = 0;
+    int depth = 0;
+    vector<RankedMove> rankedMoves; // the best SearchParameters::multiPVCount moves, best first
+    SearchStatistics statistics;
+    bool canceled = false; // the other fields are from the last completed iteration, if any
+};
+
+class GameStateCache final
+{
+    static constexpr size_t maxMovesPerRook = 14;
+    static constexpr size_t maxMovesPerKnight = 8;
+    static constexpr size_t maxMovesPerBishop = 15;
+    static constexpr size_t maxMovesPerQueen = maxMovesPerRook + maxMovesPerBishop;
+    static constexpr size_t maxMovesPerPawn = maxMovesPerQueen; // after they have been promoted
+    static constexpr size_t maxMovesPerKing = 8; // only 5 other moves when we can castle
+public:
+    static constexpr size_t maxMoves = maxMovesPerPawn * 8 + maxMovesPerRook * 2 + maxMovesPerKnight * 2 + maxMovesPerBishop * 2 + maxMovesPerQueen + maxMovesPerKing;
+    typedef vector<GameStateMove> MovesList;
+    const MovesList & getValidMoves(GameState gs);
+    // the legal moves without the cache or the check for a tie by insufficient material
+    static void generateValidMoves(GameState gs, MovesList &moves);
+    static void generatePseudoLegalMoves(GameState gs, MovesList &moves); // may leave the king in check
+private:
     struct Data final
     {
         GameState gs;
@@ -578,24 +1484,23 @@ private:
         MovesList validMoves;
         bool used = true;
         bool calculated = false;
-        vector<EvaluationEntry> evaluationValue;
         Data(GameState gs)
             : gs(gs)
         {
         }
     };
-    inline float getSortingEvaluation(Data & data)
-    {
-        while(!data.evaluationValue.empty() && !data.evaluationValue.back().hasAnyData())
-            data.evaluationValue.pop_back();
-        if(data.evaluationValue.empty())
-            data.evaluationValue.push_back(data.gs.getStaticEvaluation(*this));
-        return data.evaluationValue.back().getAverage();
-    }
-    void sortValidMoves(Data & data);
-    void sortValidMoves(GameState gs)
+    MoveOrderingHeuristics moveOrdering;
+    SearchParameters searchParameters;
+    shared_ptr<TranspositionTable> transpositionTable;
+    vector<unique_ptr<GameStateCache>> helperCaches;
+    LiveSearchStatistics liveStatistics;
+    shared_ptr<NeuralAccumulatorCache> neuralAccumulators; // made by the first neural evaluation
+    EvaluationCache evaluationCache;
+    shared_ptr<const NeuralNetwork> evaluationCacheNetwork; // the evaluator the cached scores are from
+    void sortValidMoves(Data & data, size_t ply, uint16_t ttMove);
+    void sortValidMoves(GameState gs, size_t ply, uint16_t ttMove)
     {
-        sortValidMoves(getGameStateEntry(gs));
+        sortValidMoves(getGameStateEntry(gs), ply, ttMove);
     }
     static constexpr size_t hashPrime = 100003;
     array<Data *, hashPrime> hashTable;
@@ -661,10 +1566,16 @@ private:
         hashTable[hash] = pnode;
         return *pnode;
     }
-    static constexpr size_t maxEntryCount = 1000000;
-    static constexpr size_t entryCountSlop = 100000;
+    const size_t maxEntryCount;
+    const size_t entryCountSlop;
+    const size_t maxCollectTime;
+    const size_t collectTimeSlop;
+    size_t collectTimeLeft;
 public:
-    GameStateCache()
+    static constexpr size_t defaultMaxEntryCount = 1000000;
+    // caches used by different threads can share one transposition table
+    explicit GameStateCache(shared_ptr<TranspositionTable> transpositionTable = make_shared<TranspositionTable>(), size_t maxEntryCount = defaultMaxEntryCount)
+        : transpositionTable(transpositionTable), maxEntryCount(maxEntryCount), entryCountSlop(maxEntryCount / 10), maxCollectTime(maxEntryCount * 20), collectTimeSlop(maxEntryCount * 2), collectTimeLeft(maxEntryCount * 20)
     {
         for(Data *& v : hashTable)
         {
@@ -688,9 +1599,6 @@ public:
 private:
     GameStateCache(const GameStateCache &) = delete;
     const GameStateCache & operator =(const GameStateCache &) = delete;
-    static constexpr size_t maxCollectTime = maxEntryCount * 20;
-    size_t collectTimeLeft = maxCollectTime;
-    static constexpr size_t collectTimeSlop = maxCollectTime / 10;
     inline Data & getGameStateEntry(GameState gs)
     {
         if((hashTableSize > maxEntryCount + entryCountSlop && collectTimeLeft < maxCollectTime - collectTimeSlop) || (hashTableSize > maxEntryCount && --collectTimeLeft == 0) || hashTableSize > maxEntryCount + entryCountSlop * 2)
@@ -723,22 +1631,170 @@ private:
         retval.used = true;
         return retval;
     }
-    float evaluateMoveHelper(GameState gs, atomic_bool &canceled, int depth, float bestValue, float worstValue);
-    float evaluateMove(GameState gs, atomic_bool &canceled, int depth);
+    struct ParallelSearch;
+    // the rest of the moves of a node, searched by its owner and any workers that steal a task for it
+    struct SplitPoint final
+    {
+        const SplitPoint *const parent;
+        const GameState gs;
+        const GameHistory history; // ends with gs
+        const MovesList moves;
+        const int depth;
+        const size_t ply;
+        const int extensionBudget;
+        const Score bestValue;
+        const bool futile;
+        const GameStateMove ttMove;
+        const bool ttMoveSingular;
+        atomic_bool &canceled;
+        atomic_bool cutoff;
+        atomic<size_t> activeTasks;
+        mutex lock;
+        // guarded by lock
+        size_t nextMoveIndex;
+        Score worstValue;
+        GameStateMove bestMove;
+        int pathDependencyPly = INT_MAX;
+        SplitPoint(const SplitPoint *parent, GameState gs, const GameHistory &history, MovesList moves, size_t nextMoveIndex, int depth, size_t ply, int extensionBudget, Score bestValue, Score worstValue, bool futile, GameStateMove ttMove, bool ttMoveSingular, atomic_bool &canceled)
+            : parent(parent), gs(gs), history(history), moves(std::move(moves)), depth(depth), ply(ply), extensionBudget(extensionBudget), bestValue(bestValue), futile(futile), ttMove(ttMove), ttMoveSingular(ttMoveSingular), canceled(canceled), cutoff(false), activeTasks(0), nextMoveIndex(nextMoveIndex), worstValue(worstValue)
+        {
+        }
+        // a cutoff at this or any enclosing split point makes the remaining work useless
+        bool isAborted() const
+        {
+            for(const SplitPoint *splitPoint = this; splitPoint != nullptr; splitPoint = splitPoint->parent)
+            {
+                if(splitPoint->cutoff)
+                    return true;
+            }
+            return false;
+        }
+    };
+    struct SearchContext final
+    {
+        atomic_bool &canceled;
+        const size_t cancelCheckNodeInterval;
+        size_t nodesUntilCancelCheck;
+        bool stopped = false;
+        GameHistory history; // the game followed by the current search path
+        // the lowest ply of an earlier position that a draw by repetition or the fifty-move rule depended on
+        int pathDependencyPly = INT_MAX;
+        ParallelSearch *parallel = nullptr;
+        size_t workerIndex = 0;
+        const SplitPoint *splitPoint = nullptr; // the split point this search is part of
+        SearchStatistics counts; // not yet added to statistics
+        LiveSearchStatistics &statistics;
+        SearchContext(atomic_bool &canceled, size_t cancelCheckNodeInterval, const GameHistory &history, LiveSearchStatistics &statistics)
+            : canceled(canceled), cancelCheckNodeInterval(max<size_t>(1, cancelCheckNodeInterval)), nodesUntilCancelCheck(this->cancelCheckNodeInterval), history(history), statistics(statistics)
+        {
+        }
+        SearchContext(const SearchContext &) = delete;
+        const SearchContext & operator =(const SearchContext &) = delete;
+        ~SearchContext()
+        {
+            flushStatistics();
+        }
+        void flushStatistics()
+        {
+            statistics.add(counts);
+            counts = SearchStatistics();
+        }
+        inline void reachedPly(size_t ply)
+        {
+            counts.selectiveDepth = max(counts.selectiveDepth, (int)ply);
+        }
+        // returns a saved state to pass to endPathDependencyTracking
+        inline int beginPathDependencyTracking()
+        {
+            int retval = pathDependencyPly;
+            pathDependencyPly = INT_MAX;
+            return retval;
+        }
+        // returns true if the result of the node at ply doesn't depend on how it was reached so it can be cached
+        inline bool endPathDependencyTracking(int savedPathDependencyPly, size_t ply)
+        {
+            bool retval = pathDependencyPly >= (int)ply;
+            pathDependencyPly = min(pathDependencyPly, savedPathDependencyPly);
+            return retval;
+        }
+        // called once per node; once this returns true every search function returns immediately and its result is ignored
+        inline bool poll()
+        {
+            counts.nodes++;
+            if(--nodesUntilCancelCheck == 0)
+            {
+                nodesUntilCancelCheck = cancelCheckNodeInterval;
+                flushStatistics();
+                checkStop();
+            }
+            return stopped;
+        }
+        inline bool checkStop()
+        {
+            if(canceled || (splitPoint && splitPoint->isAborted()))
+                stopped = true;
+            return stopped;
+        }
+    };
+    static Score getEndConditionScore(EndCondition endCondition, size_t ply);
+    // leaf, if set, gets the position the score comes from
+    Score quiescenceSearch(GameState gs, SearchContext &context, size_t ply, Score bestValue, Score worstValue, GameState *leaf = nullptr);
+    int getSearchExtension(GameState childGs, size_t moveCount, bool singular, int extensionBudget) const;
+    bool isSingularMove(GameState gs, SearchContext &context, const MovesList &moves, GameStateMove ttMove, Score ttValue, int depth, size_t ply);
+    Score evaluateMoveHelper(GameState gs, SearchContext &context, int depth, size_t ply, int extensionBudget, Score bestValue, Score worstValue);
+    bool searchChild(GameState gs, SearchContext &context, GameStateMove m, size_t moveCount, int depth, size_t ply, int extensionBudget, bool futile, bool singular, Score bestValue, Score worstValue, Score &value);
+    void searchSplitPoint(SplitPoint &splitPoint, ParallelSearch &parallel, size_t workerIndex);
+    void split(GameState gs, SearchContext &context, const MovesList &moves, size_t nextMoveIndex, int depth, size_t ply, int extensionBudget, bool futile, GameStateMove ttMove, bool ttMoveSingular, Score bestValue, Score &retval, GameStateMove &bestMove);
+    Score evaluateMove(GameState gs, SearchContext &context, int depth, size_t ply, int extensionBudget);
+    void seedPrincipalVariation(GameState gs, const vector<GameStateMove> &principalVariation);
+    MoveOrderingSource getMoveOrderingSource(GameState gs, size_t ply, GameStateMove m, uint16_t ttMove) const;
+    SearchResult searchWithHelpers(GameState gs, atomic_bool &canceled, int depth, atomic<float> *progress, const GameHistory *history);
+    SearchResult search(GameState gs, atomic_bool &canceled, int depth, atomic<float> *progress, const GameHistory *history, size_t helperIndex, LiveSearchStatistics &statistics, ParallelSearch *parallel = nullptr);
 public:
+    MoveOrderingHeuristics & getMoveOrderingHeuristics()
+    {
+        return moveOrdering;
+    }
+    SearchParameters & getSearchParameters()
+    {
+        return searchParameters;
+    }
+    TranspositionTable & getTranspositionTable()
+    {
+        return *transpositionTable;
+    }
+    NeuralAccumulatorCache & getNeuralAccumulators();
+    EvaluationCache & getEvaluationCache()
+    {
+        if(evaluationCacheNetwork != searchParameters.neuralNetwork)
+        {
+            evaluationCache.clear();
+            evaluationCacheNetwork = searchParameters.neuralNetwork;
+        }
+        return evaluationCache;
+    }
+    // safe to read from another thread during getBestMove
+    const LiveSearchStatistics & getLiveStatistics() const
+    {
+        return liveStatistics;
+    }
     void dumpStats()
     {
         cout << "Game State Count : " << hashTableSize;
     }
-    GameStateMove getBestMove(GameState gs, atomic_bool &canceled, int depth = 3, atomic<float> *progress = nullptr);
+    vector<GameStateMove> getPrincipalVariation(GameState gs, GameStateMove firstMove, size_t maxLength);
+    // history is the game so far ending with gs, used to detect repetitions and the fifty-move rule
+    SearchResult getBestMove(GameState gs, atomic_bool &canceled, int depth = 3, atomic<float> *progress = nullptr, const GameHistory *history = nullptr);
+    // the quiescence search's score for the player to move over the full window; leaf, if set, gets the position it comes from
+    Score getQuiescenceScore(GameState gs, GameState *leaf = nullptr);
 };
 
-inline GameStateMove getBestMove(GameState gs, GameStateCache &cache, atomic_bool &canceled, int depth = 3, atomic<float> *progress = nullptr)
+inline SearchResult getBestMove(GameState gs, GameStateCache &cache, atomic_bool &canceled, int depth = 3, atomic<float> *progress = nullptr, const GameHistory *history = nullptr)
 {
-    return cache.getBestMove(gs, canceled, depth, progress);
+    return cache.getBestMove(gs, canceled, depth, progress, history);
 }
 
-inline GameStateMove getBestMove(GameState gs, GameStateCache &cache, int depth = 3, atomic<float> *progress = nullptr)
+inline SearchResult getBestMove(GameState gs, GameStateCache &cache, int depth = 3, atomic<float> *progress = nullptr)
 {
     atomic_bool canceled(false);
     return cache.getBestMove(gs, canceled, depth, progress);
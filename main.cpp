@@ -1,4 +1,10 @@
 #include "game_state.h"
+#include "book_builder.h"
+#include "neural_network.h"
+#include "opening_book.h"
+#include "syzygy.h"
+#include "tablebase.h"
+#include "tuner.h"
 #include <cstdlib>
 #include <termios.h>
 #include <signal.h>
@@ -414,7 +420,34 @@ void keyboardThreadFn()
 
 GameState gs = GameState::makeInitialGameState();
 vector<pair<GameState, GameStateMove>> gss;
-GameStateCache cache;
+shared_ptr<TranspositionTable> transpositionTable = make_shared<TranspositionTable>();
+GameStateCache cache(transpositionTable);
+// the ponder search runs while this thread keeps using cache, so it gets its own and shares the work through the transposition table
+GameStateCache ponderCache(transpositionTable);
+const int computerSearchDepth = 5;
+
+struct PonderState
+{
+    thread searchThread;
+    atomic_bool canceled;
+    atomic<float> progress;
+    GameState gs; // the position after the predicted reply
+    SearchResult result;
+    PonderState()
+        : canceled(false), progress(0)
+    {
+    }
+};
+
+PonderState ponder;
+
+void stopPondering()
+{
+    if(!ponder.searchThread.joinable())
+        return;
+    ponder.canceled = true;
+    ponder.searchThread.join();
+}
 
 void drawBoard(int startX = -1, int startY = -1, int endX = -1, int endY = -1)
 {
@@ -427,8 +460,11 @@ void makeMove(GameStateMove m)
     gs = m.apply(gs);
 }
 
+// a ponder search for the position being taken back would keep running on every core, and a later ponder hit
+// would reuse it with a different history
 void undoMove()
 {
+    stopPondering();
     if(!gss.empty())
     {
         auto v = gss.back();
@@ -437,6 +473,23 @@ void undoMove()
     }
 }
 
+GameHistory getGameHistory()
+{
+    GameHistory retval;
+    for(size_t i = 0; i < gss.size(); i++)
+    {
+        retval.push(get<0>(gss[i]), i > 0 && get<1>(gss[i - 1]).isIrreversible(get<0>(gss[i - 1])));
+    }
+    retval.push(gs, !gss.empty() && get<1>(gss.back()).isIrreversible(get<0>(gss.back())));
+    return retval;
+}
+
+bool isDrawnByHistory()
+{
+    GameHistory history = getGameHistory();
+    return history.getRepetitionCount() >= 3 || history.isFiftyMoveRuleDraw();
+}
+
 bool anyValidMove(int startX, int startY)
 {
     auto moves = cache.getValidMoves(gs);
@@ -469,21 +522,47 @@ vector<GameStateMove> getValidMoves(int startX, int startY, int endX, int endY)
     return retval;
 }
 
+// searches the position after the reply the principal variation predicts while the human is thinking
+void startPondering(GameStateMove predictedMove)
+{
+    stopPondering();
+    ponder.gs = predictedMove.apply(gs);
+    GameHistory history = getGameHistory();
+    history.push(ponder.gs, predictedMove.isIrreversible(gs));
+    if(ponder.gs.getEndCondition(ponderCache) != EndCondition::Nothing || history.getRepetitionCount() >= 3 || history.isFiftyMoveRuleDraw())
+        return;
+    ponder.canceled = false;
+    ponder.progress = 0;
+    ponderCache.getSearchParameters() = cache.getSearchParameters();
+    ponder.searchThread = thread([history]()
+    {
+        ponder.result = getBestMove(ponder.gs, ponderCache, ponder.canceled, computerSearchDepth, &ponder.progress, &history);
+    });
+}
+
 void runComputerMove()
 {
     drawBoard();
     drawEventLog();
+    // on a ponder hit we just wait for the search that started while the human was thinking
+    const bool ponderHit = ponder.searchThread.joinable() && ponder.gs == gs;
+    if(!ponderHit)
+        stopPondering();
     atomic_bool done(false);
     atomic<float> progress(0);
-    thread waitThread([&done, &progress]()
+    atomic<float> &shownProgress = (ponderHit ? ponder.progress : progress);
+    backspacePressed = false;
+    thread waitThread([&done, &shownProgress, ponderHit]()
     {
         int i = 0;
         while(!done)
         {
+            if(ponderHit && backspacePressed)
+                ponder.canceled = true;
             ostringstream os;
             drawBoard();
             drawEventLog();
-            os << "\x1b[s\x1b[H\x1b[12BWorking (" << (int)(100 * progress) << "%)";
+            os << "\x1b[s\x1b[H\x1b[12BWorking (" << (int)(100 * shownProgress) << "%)";
             for(int j = 0; j < i + 2; j++)
                 os << ".";
             os << "\x1b[u";
@@ -500,10 +579,22 @@ void runComputerMove()
         drawBoard();
         drawEventLog();
     });
-    backspacePressed = false;
     try
     {
-        GameStateMove m = getBestMove(gs, cache, backspacePressed, 5, &progress);
+        SearchResult result;
+        if(ponderHit)
+        {
+            ponder.searchThread.join();
+            result = ponder.result;
+        }
+        else
+        {
+            GameHistory history = getGameHistory();
+            result = getBestMove(gs, cache, backspacePressed, computerSearchDepth, &progress, &history);
+        }
+        if(result.canceled)
+            throw CanceledMove();
+        GameStateMove m = result.bestMove;
         done = true;
         waitThread.join();
         drawBoard(m.startX, m.startY, m.endX, m.endY);
@@ -519,6 +610,8 @@ void runComputerMove()
         makeMove(m);
         drawBoard();
         drawEventLog();
+        if(result.principalVariation.size() >= 2)
+            startPondering(result.principalVariation[1]);
     }
     catch(CanceledMove &)
     {
@@ -587,7 +680,7 @@ void playGame(PieceColor computerColor)
     drawEventLog();
     int startX = BoardSize / 2, startY = BoardSize / 2;
     int endX = -1, endY = -1;
-    while(gs.getEndCondition(cache) == EndCondition::Nothing)
+    while(gs.getEndCondition(cache) == EndCondition::Nothing && !isDrawnByHistory())
     {
         if(getPieceColor(gs.player) == computerColor)
         {
@@ -600,6 +693,7 @@ void playGame(PieceColor computerColor)
         switch(event)
         {
         case KeyPressEvent::Q:
+            stopPondering();
             return;
         case KeyPressEvent::Space:
         case KeyPressEvent::Enter:
@@ -771,6 +865,7 @@ void playGame(PieceColor computerColor)
             break;
         }
     }
+    stopPondering();
     drawBoard();
     string sideStr = "White";
     if(gs.player == Player::Black)
@@ -786,11 +881,9 @@ void playGame(PieceColor computerColor)
         eventLog.push_back(sideStr + " Loses");
         break;
     case EndCondition::Tie:
+    case EndCondition::Nothing: // drawn by repetition or the fifty-move rule
         eventLog.push_back("Tied");
         break;
-    default:
-        assert(false);
-        break;
     }
     drawEventLog();
     for(;;)
@@ -801,8 +894,80 @@ void playGame(PieceColor computerColor)
     }
 }
 
-int main()
+void printUsage(const char *programName)
 {
+    cerr << "usage: " << programName << " [--tablebase-path <directory> | --syzygy-path <directory>] [--book <polyglot .bin file>] [--network <halfkp network file>]\n";
+    cerr << "       " << programName << " --generate-tablebases <directory> <material like KRvKP>...\n";
+    cerr << "       " << programName << " --build-book <polyglot .bin file> <pgn file>...\n";
+    cerr << "       " << programName << " --tune <epd file>...\n";
+}
+
+int main(int argc, char **argv)
+{
+    cache.getSearchParameters().threadCount = max(1u, thread::hardware_concurrency());
+    for(int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        try
+        {
+            if(arg == "--tablebase-path" && i + 1 < argc)
+            {
+                shared_ptr<GeneratedTablebase> tables = make_shared<GeneratedTablebase>();
+                tables->loadDirectory(argv[++i]);
+                cache.getSearchParameters().tablebase = tables;
+            }
+            else if(arg == "--syzygy-path" && i + 1 < argc)
+            {
+                shared_ptr<SyzygyTablebase> tables = make_shared<SyzygyTablebase>();
+                tables->loadDirectory(argv[++i]);
+                cache.getSearchParameters().tablebase = tables;
+            }
+            else if(arg == "--book" && i + 1 < argc)
+            {
+                cache.getSearchParameters().openingBook = make_shared<OpeningBook>(argv[++i]);
+            }
+            else if(arg == "--network" && i + 1 < argc)
+            {
+                cache.getSearchParameters().neuralNetwork = make_shared<NeuralNetwork>(argv[++i]);
+            }
+            else if(arg == "--build-book" && i + 1 < argc)
+            {
+                const string bookFileName = argv[++i];
+                BookBuilderOptions options;
+                options.threadCount = cache.getSearchParameters().threadCount;
+                options.log = &cout;
+                buildOpeningBook(vector<string>(argv + i + 1, argv + argc), bookFileName, options);
+                return 0;
+            }
+            else if(arg == "--tune" && i + 1 < argc)
+            {
+                TunerOptions options;
+                options.threadCount = cache.getSearchParameters().threadCount;
+                options.log = &cerr; // the parameters go to cout
+                writeEvaluationParameters(cout, tuneEvaluation(vector<string>(argv + i + 1, argv + argc), options));
+                return 0;
+            }
+            else if(arg == "--generate-tablebases" && i + 1 < argc)
+            {
+                const string directory = argv[++i];
+                GeneratedTablebase tables;
+                tables.loadDirectory(directory);
+                for(i++; i < argc; i++)
+                    generateTablebase(argv[i], directory, tables, cache.getSearchParameters().threadCount, &cout);
+                return 0;
+            }
+            else
+            {
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        catch(exception &e)
+        {
+            cerr << e.what() << endl;
+            return 1;
+        }
+    }
     setTerminalToRaw();
     atexit(handleExit);
     thread(keyboardThreadFn).detach();
@@ -0,0 +1,38 @@
+#include "mapped_file.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+
+MappedFile::MappedFile(const string &fileName)
+{
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if(fd == -1)
+        throw FileError("can't open " + fileName + ": " + strerror(errno));
+    struct stat st;
+    if(fstat(fd, &st) == -1)
+    {
+        int error = errno;
+        close(fd);
+        throw FileError("can't stat " + fileName + ": " + strerror(error));
+    }
+    size = (size_t)st.st_size;
+    if(size == 0)
+    {
+        close(fd);
+        throw FileError(fileName + " is empty");
+    }
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    int error = errno;
+    close(fd);
+    if(mapping == MAP_FAILED)
+        throw FileError("can't map " + fileName + ": " + strerror(error));
+    data = (const uint8_t *)mapping;
+}
+
+MappedFile::~MappedFile()
+{
+    munmap((void *)data, size);
+}
@@ -0,0 +1,34 @@
+#ifndef MAPPED_FILE_H_INCLUDED
+#define MAPPED_FILE_H_INCLUDED
+
+#include "game_state.h"
+
+struct FileError : public runtime_error
+{
+    explicit FileError(const string &msg)
+        : runtime_error(msg)
+    {
+    }
+};
+
+// a read-only memory mapping of a whole file
+class MappedFile final
+{
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+public:
+    explicit MappedFile(const string &fileName);
+    MappedFile(const MappedFile &) = delete;
+    const MappedFile & operator =(const MappedFile &) = delete;
+    ~MappedFile();
+    const uint8_t * getData() const
+    {
+        return data;
+    }
+    size_t getSize() const
+    {
+        return size;
+    }
+};
+
+#endif // MAPPED_FILE_H_INCLUDED
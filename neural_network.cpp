@@ -0,0 +1,271 @@
+#include "neural_network.h"
+#include <cstring>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+const char fileMagic[8] = {'H', 'A', 'L', 'F', 'K', 'P', '0', '1'};
+
+// the kings aren't features: a side's own king picks the table and the other one is left out
+constexpr size_t neuralPieceKindCount = 10;
+
+bool isFeature(PieceType piece)
+{
+    return piece != PieceType::Empty && piece != PieceType::WhiteKing && piece != PieceType::BlackKing;
+}
+
+size_t getFeatureIndex(PieceColor side, size_t kingSquare, PieceType piece, size_t square)
+{
+    const size_t flip = (side == PieceColor::White ? 0 : getSquareIndex(0, BoardSize - 1));
+    const size_t pieceIndex = getPieceKind(piece) + (getPieceColor(piece) == side ? 0 : neuralPieceKindCount / 2);
+    return ((kingSquare ^ flip) * neuralPieceKindCount + pieceIndex) * BoardSize * BoardSize + (square ^ flip);
+}
+
+void addWeights(int16_t *values, const int16_t *weights)
+{
+#if defined(__AVX2__)
+    for(size_t i = 0; i < NeuralAccumulatorSize; i += 16)
+        _mm256_storeu_si256((__m256i *)(values + i), _mm256_add_epi16(_mm256_loadu_si256((const __m256i *)(values + i)), _mm256_loadu_si256((const __m256i *)(weights + i))));
+#elif defined(__SSE2__)
+    for(size_t i = 0; i < NeuralAccumulatorSize; i += 8)
+        _mm_storeu_si128((__m128i *)(values + i), _mm_add_epi16(_mm_loadu_si128((const __m128i *)(values + i)), _mm_loadu_si128((const __m128i *)(weights + i))));
+#else
+    for(size_t i = 0; i < NeuralAccumulatorSize; i++)
+        values[i] = (int16_t)(values[i] + weights[i]);
+#endif
+}
+
+void subtractWeights(int16_t *values, const int16_t *weights)
+{
+#if defined(__AVX2__)
+    for(size_t i = 0; i < NeuralAccumulatorSize; i += 16)
+        _mm256_storeu_si256((__m256i *)(values + i), _mm256_sub_epi16(_mm256_loadu_si256((const __m256i *)(values + i)), _mm256_loadu_si256((const __m256i *)(weights + i))));
+#elif defined(__SSE2__)
+    for(size_t i = 0; i < NeuralAccumulatorSize; i += 8)
+        _mm_storeu_si128((__m128i *)(values + i), _mm_sub_epi16(_mm_loadu_si128((const __m128i *)(values + i)), _mm_loadu_si128((const __m128i *)(weights + i))));
+#else
+    for(size_t i = 0; i < NeuralAccumulatorSize; i++)
+        values[i] = (int16_t)(values[i] - weights[i]);
+#endif
+}
+
+void clipAccumulator(const int16_t *values, uint8_t *output)
+{
+#if defined(__AVX2__)
+    const __m256i zero = _mm256_setzero_si256(), ceiling = _mm256_set1_epi16(127);
+    for(size_t i = 0; i < NeuralAccumulatorSize; i += 32)
+    {
+        const __m256i low = _mm256_min_epi16(_mm256_max_epi16(_mm256_loadu_si256((const __m256i *)(values + i)), zero), ceiling);
+        const __m256i high = _mm256_min_epi16(_mm256_max_epi16(_mm256_loadu_si256((const __m256i *)(values + i + 16)), zero), ceiling);
+        // packing works within each 128 bit lane, so the quarters need putting back in order
+        _mm256_storeu_si256((__m256i *)(output + i), _mm256_permute4x64_epi64(_mm256_packus_epi16(low, high), 0xD8));
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128(), ceiling = _mm_set1_epi16(127);
+    for(size_t i = 0; i < NeuralAccumulatorSize; i += 16)
+    {
+        const __m128i low = _mm_min_epi16(_mm_max_epi16(_mm_loadu_si128((const __m128i *)(values + i)), zero), ceiling);
+        const __m128i high = _mm_min_epi16(_mm_max_epi16(_mm_loadu_si128((const __m128i *)(values + i + 8)), zero), ceiling);
+        _mm_storeu_si128((__m128i *)(output + i), _mm_packus_epi16(low, high));
+    }
+#else
+    for(size_t i = 0; i < NeuralAccumulatorSize; i++)
+        output[i] = (uint8_t)min<int>(max<int>(values[i], 0), 127);
+#endif
+}
+
+#if defined(__SSE2__)
+int32_t getHorizontalSum(__m128i sum)
+{
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sum);
+}
+#endif
+
+// count is a multiple of 32; the inputs are at most 127 so the paired products can't saturate
+int32_t getDotProduct(const uint8_t *inputs, const int8_t *weights, size_t count)
+{
+#if defined(__AVX2__)
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i sum = _mm256_setzero_si256();
+    for(size_t i = 0; i < count; i += 32)
+    {
+        const __m256i products = _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i *)(inputs + i)), _mm256_loadu_si256((const __m256i *)(weights + i)));
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(products, ones));
+    }
+    return getHorizontalSum(_mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1)));
+#elif defined(__SSSE3__)
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i sum = _mm_setzero_si128();
+    for(size_t i = 0; i < count; i += 16)
+    {
+        const __m128i products = _mm_maddubs_epi16(_mm_loadu_si128((const __m128i *)(inputs + i)), _mm_loadu_si128((const __m128i *)(weights + i)));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(products, ones));
+    }
+    return getHorizontalSum(sum);
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum = _mm_setzero_si128();
+    for(size_t i = 0; i < count; i += 16)
+    {
+        const __m128i input = _mm_loadu_si128((const __m128i *)(inputs + i));
+        const __m128i weight = _mm_loadu_si128((const __m128i *)(weights + i));
+        // widen to 16 bits, sign extending the weights by shifting them down from the high byte
+        const __m128i lowWeights = _mm_srai_epi16(_mm_unpacklo_epi8(weight, weight), 8);
+        const __m128i highWeights = _mm_srai_epi16(_mm_unpackhi_epi8(weight, weight), 8);
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpacklo_epi8(input, zero), lowWeights));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpackhi_epi8(input, zero), highWeights));
+    }
+    return getHorizontalSum(sum);
+#else
+    int32_t sum = 0;
+    for(size_t i = 0; i < count; i++)
+        sum += (int32_t)inputs[i] * weights[i];
+    return sum;
+#endif
+}
+
+void evaluateHiddenLayer(const uint8_t *inputs, size_t inputCount, const vector<int32_t> &biases, const vector<int8_t> &weights, uint8_t *outputs)
+{
+    for(size_t i = 0; i < NeuralHiddenSize; i++)
+    {
+        const int32_t sum = biases[i] + getDotProduct(inputs, &weights[i * inputCount], inputCount);
+        outputs[i] = (uint8_t)min<int32_t>(max<int32_t>(sum, 0) / 64, 127);
+    }
+}
+
+class NetworkReader final
+{
+    const MappedFile &file;
+    const string &fileName;
+    size_t offset = 0;
+    uint64_t read(size_t byteCount)
+    {
+        if(file.getSize() - offset < byteCount)
+            throw FileError(fileName + " is truncated");
+        uint64_t retval = 0;
+        for(size_t i = 0; i < byteCount; i++)
+            retval |= (uint64_t)file.getData()[offset + i] << (8 * i);
+        offset += byteCount;
+        return retval;
+    }
+public:
+    NetworkReader(const MappedFile &file, const string &fileName)
+        : file(file), fileName(fileName)
+    {
+    }
+    void readMagic()
+    {
+        if(file.getSize() < sizeof(fileMagic) || memcmp(file.getData(), fileMagic, sizeof(fileMagic)) != 0)
+            throw FileError(fileName + " isn't a halfkp network");
+        offset += sizeof(fileMagic);
+    }
+    void readSize(size_t expected)
+    {
+        if(read(4) != expected)
+            throw FileError(fileName + " has a different network size");
+    }
+    template <typename T>
+    void readValues(vector<T> &values, size_t count)
+    {
+        values.resize(count);
+        for(T &value : values)
+            value = (T)read(sizeof(T));
+    }
+    void finish()
+    {
+        if(offset != file.getSize())
+            throw FileError(fileName + " has extra data");
+    }
+};
+}
+
+NeuralNetwork::NeuralNetwork(const string &fileName)
+{
+    MappedFile file(fileName);
+    NetworkReader reader(file, fileName);
+    reader.readMagic();
+    reader.readSize(NeuralFeatureCount);
+    reader.readSize(NeuralAccumulatorSize);
+    reader.readSize(NeuralHiddenSize);
+    reader.readValues(featureBiases, NeuralAccumulatorSize);
+    reader.readValues(featureWeights, NeuralFeatureCount * NeuralAccumulatorSize);
+    reader.readValues(hidden1Biases, NeuralHiddenSize);
+    reader.readValues(hidden1Weights, NeuralHiddenSize * 2 * NeuralAccumulatorSize);
+    reader.readValues(hidden2Biases, NeuralHiddenSize);
+    reader.readValues(hidden2Weights, NeuralHiddenSize * NeuralHiddenSize);
+    vector<int32_t> outputBiases;
+    reader.readValues(outputBiases, 1);
+    outputBias = outputBiases[0];
+    reader.readValues(outputWeights, NeuralHiddenSize);
+    reader.finish();
+}
+
+void NeuralNetwork::updateAccumulator(NeuralAccumulatorCache::Entry &entry, const GameState &gs, PieceColor side, size_t kingSquare) const
+{
+    for(size_t x = 0; x < BoardSize; x++)
+    {
+        for(size_t y = 0; y < BoardSize; y++)
+        {
+            const size_t square = getSquareIndex(x, y);
+            const PieceType oldPiece = entry.pieces[square], newPiece = gs.board[x][y];
+            if(oldPiece == newPiece)
+                continue;
+            if(isFeature(oldPiece))
+                subtractWeights(entry.values.data(), &featureWeights[getFeatureIndex(side, kingSquare, oldPiece, square) * NeuralAccumulatorSize]);
+            if(isFeature(newPiece))
+                addWeights(entry.values.data(), &featureWeights[getFeatureIndex(side, kingSquare, newPiece, square) * NeuralAccumulatorSize]);
+            entry.pieces[square] = newPiece;
+        }
+    }
+}
+
+Score NeuralNetwork::evaluate(const GameState &gs, NeuralAccumulatorCache &accumulators) const
+{
+    if(accumulators.network != this)
+    {
+        // an empty board's accumulator is just the biases
+        for(auto &sideEntries : accumulators.entries)
+        {
+            for(NeuralAccumulatorCache::Entry &entry : sideEntries)
+            {
+                entry.pieces.fill(PieceType::Empty);
+                copy(featureBiases.begin(), featureBiases.end(), entry.values.begin());
+            }
+        }
+        accumulators.network = this;
+    }
+    array<size_t, 2> kingSquares = {{0, 0}};
+    for(size_t x = 0; x < BoardSize; x++)
+    {
+        for(size_t y = 0; y < BoardSize; y++)
+        {
+            if(gs.board[x][y] == PieceType::WhiteKing)
+                kingSquares[0] = getSquareIndex(x, y);
+            else if(gs.board[x][y] == PieceType::BlackKing)
+                kingSquares[1] = getSquareIndex(x, y);
+        }
+    }
+    array<uint8_t, 2 * NeuralAccumulatorSize> inputs;
+    for(size_t i = 0; i < 2; i++)
+    {
+        const PieceColor side = (i == 0 ? PieceColor::White : PieceColor::Black);
+        NeuralAccumulatorCache::Entry &entry = accumulators.entries[i][kingSquares[i]];
+        updateAccumulator(entry, gs, side, kingSquares[i]);
+        clipAccumulator(entry.values.data(), &inputs[getPieceColor(gs.player) == side ? 0 : NeuralAccumulatorSize]);
+    }
+    array<uint8_t, NeuralHiddenSize> hidden1, hidden2;
+    evaluateHiddenLayer(inputs.data(), inputs.size(), hidden1Biases, hidden1Weights, hidden1.data());
+    evaluateHiddenLayer(hidden1.data(), hidden1.size(), hidden2Biases, hidden2Weights, hidden2.data());
+    const int32_t output = (outputBias + getDotProduct(hidden2.data(), outputWeights.data(), NeuralHiddenSize)) / 16;
+    // stay clear of the scores for mates and tablebase wins
+    const int32_t maxScore = TablebaseWinScore - MaxMatePly - 1;
+    return (Score)min(max(output, -maxScore), maxScore);
+}
@@ -0,0 +1,48 @@
+#ifndef NEURAL_NETWORK_H_INCLUDED
+#define NEURAL_NETWORK_H_INCLUDED
+
+#include "game_state.h"
+#include "mapped_file.h"
+
+// halfkp: for each side, every piece other than the kings on each square, relative to that side's king;
+// black's features are seen with the board flipped so both sides share the weights
+constexpr size_t NeuralFeatureCount = BoardSize * BoardSize * 10 * BoardSize * BoardSize;
+constexpr size_t NeuralAccumulatorSize = 256;
+constexpr size_t NeuralHiddenSize = 32;
+
+class NeuralNetwork;
+
+// the accumulators of the last position evaluated with each king square, for each side; the next position
+// with that king square only needs the features of the squares that changed, which in a search is a few moves' worth
+class NeuralAccumulatorCache final
+{
+    friend class NeuralNetwork;
+    struct Entry final
+    {
+        array<PieceType, BoardSize * BoardSize> pieces; // what the accumulator is for, by getSquareIndex
+        array<int16_t, NeuralAccumulatorSize> values;
+    };
+    const NeuralNetwork *network = nullptr;
+    array<array<Entry, BoardSize * BoardSize>, 2> entries; // indexed by side and king square
+};
+
+// an efficiently updatable network: the two accumulators, side to move first and clipped to 0 through 127,
+// then two hidden layers of NeuralHiddenSize clipped to 0 through 127 after dividing by 64, then the output
+// divided by 16 in centipawns for the side to move
+//
+// the file is little-endian: the 8 bytes "HALFKP01", the three sizes above as uint32, then the accumulator
+// biases and weights (int16, NeuralAccumulatorSize per feature), then for each of the other layers the
+// biases (int32) and the weights (int8, one row of inputs per output)
+class NeuralNetwork final
+{
+    vector<int16_t> featureBiases, featureWeights;
+    vector<int32_t> hidden1Biases, hidden2Biases;
+    vector<int8_t> hidden1Weights, hidden2Weights, outputWeights;
+    int32_t outputBias;
+    void updateAccumulator(NeuralAccumulatorCache::Entry &entry, const GameState &gs, PieceColor side, size_t kingSquare) const;
+public:
+    explicit NeuralNetwork(const string &fileName);
+    Score evaluate(const GameState &gs, NeuralAccumulatorCache &accumulators) const;
+};
+
+#endif // NEURAL_NETWORK_H_INCLUDED
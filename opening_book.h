@@ -0,0 +1,36 @@
+#ifndef OPENING_BOOK_H_INCLUDED
+#define OPENING_BOOK_H_INCLUDED
+
+#include "game_state.h"
+#include "mapped_file.h"
+
+// the key of gs in a Polyglot book
+uint64_t getPolyglotKey(const GameState &gs);
+// the from and to squares and the promotion in 16 bits; castling is written as the king taking its own rook
+uint16_t getPolyglotMove(const GameState &gs, GameStateMove m);
+
+struct BookMove final
+{
+    GameStateMove move;
+    unsigned weight;
+};
+
+// a Polyglot .bin book: 16 byte big-endian entries of key, move, weight and learn value, sorted by key
+class OpeningBook final
+{
+    MappedFile file;
+    size_t entryCount;
+    uint64_t getKey(size_t index) const;
+public:
+    static constexpr size_t entrySize = 16;
+    explicit OpeningBook(const string &fileName);
+    size_t getEntryCount() const
+    {
+        return entryCount;
+    }
+    vector<BookMove> getMoves(const GameState &gs) const; // only the legal ones, in the book's order
+    // returns false if the book has no move with a nonzero weight for gs
+    bool chooseMove(const GameState &gs, BookMoveSelection selection, GameStateMove &result) const;
+};
+
+#endif // OPENING_BOOK_H_INCLUDED
@@ -0,0 +1,910 @@
+#include "syzygy.h"
+#include <dirent.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+
+namespace
+{
+const uint8_t wdlFileMagic[4] = {0x71, 0xE8, 0x23, 0x5D};
+const uint8_t dtzFileMagic[4] = {0xD7, 0x66, 0x0C, 0xA5};
+constexpr int squareCount = BoardSize * BoardSize;
+
+// the flags of each side to move and lead pawn file's part of a table
+enum : uint8_t
+{
+    sideToMoveFlag = 1, // distance tables: which player to move the part holds
+    mappedFlag = 2, // distance tables: the stored values are looked up in the distance map
+    winPliesFlag = 4, // distance tables: wins are stored in plies instead of moves
+    lossPliesFlag = 8,
+    wideFlag = 16, // distance tables: the distance map has 16 bit entries
+    singleValueFlag = 128 // every position has the same value, so nothing is compressed
+};
+
+// Syzygy numbers the pieces pawn, knight, bishop, rook, queen and king from 1 for white and from 9 for black;
+// squares go from a1 = 0 to h8 = 63 like getSquareIndex
+uint8_t getSyzygyPiece(PieceType piece)
+{
+    switch(piece)
+    {
+    case PieceType::Empty:
+        return 0;
+    case PieceType::WhitePawn:
+        return 1;
+    case PieceType::WhiteKnight:
+        return 2;
+    case PieceType::WhiteBishop:
+        return 3;
+    case PieceType::WhiteRook:
+        return 4;
+    case PieceType::WhiteQueen:
+        return 5;
+    case PieceType::WhiteKing:
+        return 6;
+    case PieceType::BlackPawn:
+        return 9;
+    case PieceType::BlackKnight:
+        return 10;
+    case PieceType::BlackBishop:
+        return 11;
+    case PieceType::BlackRook:
+        return 12;
+    case PieceType::BlackQueen:
+        return 13;
+    case PieceType::BlackKing:
+        return 14;
+    }
+    assert(false);
+    return 0;
+}
+
+int getFile(int square)
+{
+    return square % BoardSize;
+}
+
+int getRank(int square)
+{
+    return square / BoardSize;
+}
+
+// 0 on the a1-h8 diagonal, negative below it
+int getDiagonalOffset(int square)
+{
+    return getRank(square) - getFile(square);
+}
+
+// the numberings Syzygy's position indexes are built from
+struct EncodingTables final
+{
+    array<int, squareCount> mapB1H1H7; // the squares below the a1-h8 diagonal to 0 to 27
+    array<int, squareCount> mapA1D1D4; // the a1-d1-d4 triangle to 0 to 9, the diagonal last
+    array<array<int, squareCount>, 10> mapKK; // the 462 placements of two kings with the first in the triangle
+    array<array<uint64_t, squareCount>, MaxSyzygyPieceCount> binomial; // [k][n]: the ways to choose k of n squares
+    array<int, squareCount> mapPawns; // a2 to h7 to 47 down to 0, so the pawn with the highest is the lead pawn
+    array<array<int, squareCount>, 6> leadPawnIndexes; // by the number of lead pawns, then the lead pawn's square
+    array<array<uint64_t, 4>, 6> leadPawnsSizes; // by the number of lead pawns, then the lead pawn's file
+    EncodingTables()
+    {
+        for(auto *table : {&mapB1H1H7, &mapA1D1D4, &mapPawns})
+            table->fill(0);
+        for(auto &table : mapKK)
+            table.fill(0);
+        for(auto &table : binomial)
+            table.fill(0);
+        for(auto &table : leadPawnIndexes)
+            table.fill(0);
+        for(auto &table : leadPawnsSizes)
+            table.fill(0);
+        int code = 0;
+        for(int square = 0; square < squareCount; square++)
+        {
+            if(getDiagonalOffset(square) < 0)
+                mapB1H1H7[square] = code++;
+        }
+        code = 0;
+        vector<int> diagonal;
+        for(int square = 0; square <= (int)getSquareIndex(3, 3); square++)
+        {
+            if(getDiagonalOffset(square) < 0 && getFile(square) <= 3)
+                mapA1D1D4[square] = code++;
+            else if(getDiagonalOffset(square) == 0 && getFile(square) <= 3)
+                diagonal.push_back(square);
+        }
+        for(int square : diagonal)
+            mapA1D1D4[square] = code++;
+        // with the first king on the diagonal the second one isn't above it, and both on the diagonal come last
+        code = 0;
+        vector<pair<int, int>> bothOnDiagonal;
+        for(int index = 0; index < 10; index++)
+        {
+            for(int first = 0; first <= (int)getSquareIndex(3, 3); first++)
+            {
+                if(mapA1D1D4[first] != index || (index == 0 && first != (int)getSquareIndex(1, 0)))
+                    continue;
+                for(int second = 0; second < squareCount; second++)
+                {
+                    if(abs(getFile(first) - getFile(second)) <= 1 && abs(getRank(first) - getRank(second)) <= 1)
+                        continue;
+                    if(getDiagonalOffset(first) == 0 && getDiagonalOffset(second) > 0)
+                        continue;
+                    if(getDiagonalOffset(first) == 0 && getDiagonalOffset(second) == 0)
+                        bothOnDiagonal.push_back(make_pair(index, second));
+                    else
+                        mapKK[index][second] = code++;
+                }
+            }
+        }
+        for(const pair<int, int> &kings : bothOnDiagonal)
+            mapKK[kings.first][kings.second] = code++;
+        assert(code == 462);
+        binomial[0][0] = 1;
+        for(int n = 1; n < squareCount; n++)
+        {
+            for(int k = 0; k < (int)MaxSyzygyPieceCount && k <= n; k++)
+                binomial[k][n] = (k > 0 ? binomial[k - 1][n - 1] : 0) + (k < n ? binomial[k][n - 1] : 0);
+        }
+        // the lead pawn is the one nearest the edge and, on the same file, the lowest; the other pawns can't be on
+        // squares that come before it, which leaves 47 for a lead pawn on a2 and two fewer for each rank further up
+        int availableSquares = 47;
+        for(int leadPawnCount = 1; leadPawnCount <= 5; leadPawnCount++)
+        {
+            for(int file = 0; file < 4; file++)
+            {
+                int index = 0;
+                for(int rank = 1; rank < (int)BoardSize - 1; rank++)
+                {
+                    const int square = getSquareIndex(file, rank);
+                    if(leadPawnCount == 1)
+                    {
+                        mapPawns[square] = availableSquares--;
+                        mapPawns[square ^ 7] = availableSquares--;
+                    }
+                    leadPawnIndexes[leadPawnCount][square] = index;
+                    index += binomial[leadPawnCount - 1][mapPawns[square]];
+                }
+                leadPawnsSizes[leadPawnCount][file] = index;
+            }
+        }
+    }
+};
+
+const EncodingTables & getEncodingTables()
+{
+    static const EncodingTables tables;
+    return tables;
+}
+
+uint64_t readLittleEndian(const uint8_t *bytes, size_t byteCount)
+{
+    uint64_t retval = 0;
+    for(size_t i = 0; i < byteCount; i++)
+        retval |= (uint64_t)bytes[i] << (8 * i);
+    return retval;
+}
+
+// the bytes past end read as zeros
+uint64_t readBigEndian(const uint8_t *bytes, size_t byteCount, const uint8_t *end)
+{
+    uint64_t retval = 0;
+    for(size_t i = 0; i < byteCount; i++)
+        retval = retval << 8 | (bytes + i < end ? bytes[i] : 0);
+    return retval;
+}
+
+// one side to move and lead pawn file of a table: the order the pieces are indexed in, how they're grouped, and the
+// values compressed by recursive pairing, each block a string of canonical Huffman codes for symbols that expand
+// into pairs of symbols down to the values
+struct PairsData final
+{
+    uint8_t flags = 0;
+    array<uint8_t, MaxSyzygyPieceCount> pieces = {{}};
+    array<int, MaxSyzygyPieceCount + 1> groupLengths = {{}}; // 0 after the last group
+    // what each group's number is multiplied by in the index; the one after the last group is the table's size
+    array<uint64_t, MaxSyzygyPieceCount + 1> groupIndexes = {{}};
+    // distance tables: where the distance map's values for a win, a loss, a cursed win and a blessed loss start
+    array<size_t, 4> mapIndexes = {{}}, mapSizes = {{}};
+    uint64_t blockSize = 0, span = 0; // span is how many values each sparse index entry covers
+    size_t sparseIndexSize = 0, blockCount = 0, blockLengthCount = 0;
+    int minSymbolLength = 0, maxSymbolLength = 0; // minSymbolLength is the value with singleValueFlag
+    const uint8_t *lowestSymbols = nullptr; // little-endian 16 bit symbols by code length
+    vector<uint64_t> bases; // by code length, the smallest code shifted to the top of 64 bits
+    vector<uint8_t> symbolLengths; // how many values each symbol expands to, minus one
+    const uint8_t *symbolPairs = nullptr; // 12 bits each for the left and right symbols, or the value and 0xFFF
+    const uint8_t *sparseIndex = nullptr; // 32 bit block and 16 bit offset in it of the middle value of each span
+    const uint8_t *blockLengths = nullptr; // 16 bit values per block, minus one
+    const uint8_t *data = nullptr;
+    size_t getLeftSymbol(size_t symbol) const
+    {
+        const uint8_t *pair = symbolPairs + 3 * symbol;
+        return (size_t)(pair[1] & 0xF) << 8 | pair[0];
+    }
+    size_t getRightSymbol(size_t symbol) const
+    {
+        const uint8_t *pair = symbolPairs + 3 * symbol;
+        return (size_t)pair[2] << 4 | pair[1] >> 4;
+    }
+    size_t getTableSize() const
+    {
+        return groupIndexes[find(groupLengths.begin(), groupLengths.end(), 0) - groupLengths.begin()];
+    }
+    bool decompress(uint64_t index, int &result) const;
+};
+
+int setSymbolLength(PairsData &d, size_t symbol, vector<bool> &visited, const string &fileName)
+{
+    visited[symbol] = true;
+    const size_t right = d.getRightSymbol(symbol);
+    if(right == 0xFFF)
+        return 0;
+    const size_t left = d.getLeftSymbol(symbol);
+    if(left >= d.symbolLengths.size() || right >= d.symbolLengths.size())
+        throw TablebaseFileError(fileName + " is corrupt");
+    if(!visited[left])
+        d.symbolLengths[left] = (uint8_t)setSymbolLength(d, left, visited, fileName);
+    if(!visited[right])
+        d.symbolLengths[right] = (uint8_t)setSymbolLength(d, right, visited, fileName);
+    return d.symbolLengths[left] + d.symbolLengths[right] + 1;
+}
+
+// returns false if the data doesn't hold a value for index
+bool PairsData::decompress(uint64_t index, int &result) const
+{
+    if(flags & singleValueFlag)
+    {
+        result = minSymbolLength;
+        return true;
+    }
+    // the sparse index finds a block near the value, and the block lengths walk from there to the right one
+    const uint64_t spanIndex = index / span;
+    if(spanIndex >= sparseIndexSize)
+        return false;
+    size_t block = (size_t)readLittleEndian(sparseIndex + 6 * spanIndex, 4);
+    int64_t offset = (int64_t)readLittleEndian(sparseIndex + 6 * spanIndex + 4, 2) + (int64_t)(index % span) - (int64_t)(span / 2);
+    if(block >= blockLengthCount)
+        return false;
+    while(offset < 0)
+    {
+        if(block == 0)
+            return false;
+        block--;
+        offset += (int64_t)readLittleEndian(blockLengths + 2 * block, 2) + 1;
+    }
+    while(offset > (int64_t)readLittleEndian(blockLengths + 2 * block, 2))
+    {
+        offset -= (int64_t)readLittleEndian(blockLengths + 2 * block, 2) + 1;
+        if(++block >= blockLengthCount)
+            return false;
+    }
+    if(block >= blockCount)
+        return false;
+    // a longer code is smaller than any shorter one padded out, so its length is the first base it isn't below
+    const uint8_t *next = data + block * blockSize;
+    const uint8_t *const end = next + blockSize;
+    uint64_t buffer = readBigEndian(next, 8, end);
+    next += 8;
+    int bufferBits = 64;
+    size_t symbol;
+    for(;;)
+    {
+        size_t length = 0;
+        while(buffer < bases[length])
+            length++;
+        symbol = (size_t)((buffer - bases[length]) >> (64 - length - minSymbolLength)) + (size_t)readLittleEndian(lowestSymbols + 2 * length, 2);
+        if(symbol >= symbolLengths.size())
+            return false;
+        if(offset < (int64_t)symbolLengths[symbol] + 1)
+            break;
+        offset -= (int64_t)symbolLengths[symbol] + 1;
+        length += minSymbolLength;
+        buffer <<= length;
+        bufferBits -= (int)length;
+        if(bufferBits <= 32)
+        {
+            bufferBits += 32;
+            buffer |= readBigEndian(next, 4, end) << (64 - bufferBits);
+            next += 4;
+        }
+    }
+    // the symbols a pair expands to are next to each other, so the offset picks a side until it reaches a value
+    while(symbolLengths[symbol] != 0)
+    {
+        const size_t left = getLeftSymbol(symbol);
+        if(offset < (int64_t)symbolLengths[left] + 1)
+            symbol = left;
+        else
+        {
+            offset -= (int64_t)symbolLengths[left] + 1;
+            symbol = getRightSymbol(symbol);
+        }
+    }
+    result = (int)getLeftSymbol(symbol);
+    return true;
+}
+
+struct TableFile final
+{
+    unique_ptr<MappedFile> file; // null if the table doesn't have this file
+    array<array<PairsData, 4>, 2> pairs; // by the side to move, then the lead pawn's file, a to d
+    const uint8_t *distanceMap = nullptr;
+};
+
+// reads a file front to back, throwing if it runs past the end
+struct FileReader final
+{
+    const uint8_t *begin, *current, *end;
+    const string &fileName;
+    FileReader(const MappedFile &file, const string &fileName)
+        : begin(file.getData()), current(file.getData()), end(file.getData() + file.getSize()), fileName(fileName)
+    {
+    }
+    const uint8_t * take(size_t byteCount)
+    {
+        if(byteCount > (size_t)(end - current))
+            throw TablebaseFileError(fileName + " is corrupt");
+        const uint8_t *retval = current;
+        current += byteCount;
+        return retval;
+    }
+    void align(size_t alignment) // the mapping starts on a page, so this aligns the addresses too
+    {
+        current += min((alignment - (size_t)(current - begin) % alignment) % alignment, (size_t)(end - current));
+    }
+};
+
+void readSizes(FileReader &reader, PairsData &d)
+{
+    d.flags = *reader.take(1);
+    if(d.flags & singleValueFlag)
+    {
+        d.minSymbolLength = *reader.take(1);
+        return;
+    }
+    const uint8_t *header = reader.take(9);
+    if(header[0] >= 32 || header[1] >= 32)
+        throw TablebaseFileError(reader.fileName + " is corrupt");
+    d.blockSize = (uint64_t)1 << header[0];
+    d.span = (uint64_t)1 << header[1];
+    d.sparseIndexSize = (size_t)((d.getTableSize() + d.span - 1) / d.span);
+    d.blockCount = (size_t)readLittleEndian(header + 3, 4);
+    d.blockLengthCount = d.blockCount + header[2]; // padded so the sparse index can't point past the end
+    d.maxSymbolLength = header[7];
+    d.minSymbolLength = header[8];
+    if(d.minSymbolLength < 1 || d.maxSymbolLength < d.minSymbolLength || d.maxSymbolLength > 32)
+        throw TablebaseFileError(reader.fileName + " is corrupt");
+    const size_t lengthCount = d.maxSymbolLength - d.minSymbolLength + 1;
+    d.lowestSymbols = reader.take(2 * lengthCount);
+    // canonical Huffman codes: longer codes have lower values, and the codes of one length are consecutive
+    d.bases.assign(lengthCount, 0);
+    for(size_t i = lengthCount - 1; i-- > 0;)
+        d.bases[i] = (d.bases[i + 1] + readLittleEndian(d.lowestSymbols + 2 * i, 2) - readLittleEndian(d.lowestSymbols + 2 * (i + 1), 2)) / 2;
+    for(size_t i = 0; i < lengthCount; i++)
+        d.bases[i] <<= 64 - i - d.minSymbolLength;
+    d.symbolLengths.assign((size_t)readLittleEndian(reader.take(2), 2), 0);
+    d.symbolPairs = reader.take(3 * d.symbolLengths.size());
+    vector<bool> visited(d.symbolLengths.size(), false);
+    for(size_t symbol = 0; symbol < d.symbolLengths.size(); symbol++)
+    {
+        if(!visited[symbol])
+            d.symbolLengths[symbol] = (uint8_t)setSymbolLength(d, symbol, visited, reader.fileName);
+    }
+    reader.take(d.symbolLengths.size() & 1);
+}
+}
+
+struct SyzygyTablebase::Table final
+{
+    string signature; // the file's: its first side is white
+    vector<PieceType> pieces;
+    bool hasPawns = false;
+    bool hasUniquePieces = false; // a piece other than a king that's the only one of its kind and color
+    bool symmetric; // both sides have the same pieces, so only white to move is stored
+    array<size_t, 2> pawnCounts; // the leading color's first: the one with fewer pawns, but at least one
+    TableFile wdl, dtz;
+    Table(const string &signature, const vector<PieceType> &pieces)
+        : signature(signature), pieces(pieces), symmetric(signature == getColorSwappedSignature(signature))
+    {
+        for(PieceType piece : pieces)
+        {
+            if(piece == PieceType::WhitePawn || piece == PieceType::BlackPawn)
+                hasPawns = true;
+            if(piece != PieceType::WhiteKing && piece != PieceType::BlackKing && count(pieces.begin(), pieces.end(), piece) == 1)
+                hasUniquePieces = true;
+        }
+        const size_t whitePawns = count(pieces.begin(), pieces.end(), PieceType::WhitePawn);
+        const size_t blackPawns = count(pieces.begin(), pieces.end(), PieceType::BlackPawn);
+        const bool whiteLeads = blackPawns == 0 || (whitePawns != 0 && blackPawns >= whitePawns);
+        pawnCounts[0] = (whiteLeads ? whitePawns : blackPawns);
+        pawnCounts[1] = (whiteLeads ? blackPawns : whitePawns);
+    }
+    // a group is pieces of one kind and color indexed together, except that without pawns the first group is the
+    // first three pieces if there's a unique piece and the two kings otherwise; order says where the first group and
+    // the other side's pawns go among the others
+    void setGroups(PairsData &d, const int *order, size_t file) const
+    {
+        const EncodingTables &tables = getEncodingTables();
+        size_t groupCount = 0;
+        int firstGroupLength = (hasPawns ? 0 : hasUniquePieces ? 3 : 2);
+        d.groupLengths[0] = 1;
+        for(size_t i = 1; i < pieces.size(); i++)
+        {
+            if(--firstGroupLength > 0 || d.pieces[i] == d.pieces[i - 1])
+                d.groupLengths[groupCount]++;
+            else
+                d.groupLengths[++groupCount] = 1;
+        }
+        d.groupLengths[++groupCount] = 0;
+        const bool pawnsOnBothSides = hasPawns && pawnCounts[1] != 0;
+        size_t next = (pawnsOnBothSides ? 2 : 1);
+        int freeSquares = squareCount - d.groupLengths[0] - (pawnsOnBothSides ? d.groupLengths[1] : 0);
+        uint64_t index = 1;
+        for(int k = 0; next < groupCount || k == order[0] || k == order[1]; k++)
+        {
+            if(k == order[0])
+            {
+                d.groupIndexes[0] = index;
+                index *= (hasPawns ? tables.leadPawnsSizes[d.groupLengths[0]][file] : hasUniquePieces ? 31332 : 462);
+            }
+            else if(k == order[1])
+            {
+                d.groupIndexes[1] = index;
+                index *= tables.binomial[d.groupLengths[1]][48 - d.groupLengths[0]];
+            }
+            else
+            {
+                d.groupIndexes[next] = index;
+                index *= tables.binomial[d.groupLengths[next]][freeSquares];
+                freeSquares -= d.groupLengths[next++];
+            }
+        }
+        d.groupIndexes[groupCount] = index;
+    }
+    void load(TableFile &tableFile, const string &fileName, bool distance)
+    {
+        tableFile.file.reset(new MappedFile(fileName));
+        FileReader reader(*tableFile.file, fileName);
+        if(memcmp(reader.take(sizeof(wdlFileMagic)), distance ? dtzFileMagic : wdlFileMagic, sizeof(wdlFileMagic)) != 0)
+            throw TablebaseFileError(fileName + " isn't a Syzygy table");
+        if(((*reader.take(1) & 2) != 0) != hasPawns)
+            throw TablebaseFileError(fileName + " is corrupt");
+        const size_t sideCount = (!distance && !symmetric ? 2 : 1);
+        const size_t fileCount = (hasPawns ? 4 : 1);
+        const bool pawnsOnBothSides = hasPawns && pawnCounts[1] != 0;
+        vector<uint8_t> expectedPieces;
+        for(PieceType piece : pieces)
+            expectedPieces.push_back(getSyzygyPiece(piece));
+        sort(expectedPieces.begin(), expectedPieces.end());
+        for(size_t file = 0; file < fileCount; file++)
+        {
+            const uint8_t *orderBytes = reader.take(pawnsOnBothSides ? 2 : 1);
+            const int orders[2][2] =
+            {
+                {orderBytes[0] & 0xF, pawnsOnBothSides ? orderBytes[1] & 0xF : 0xF},
+                {orderBytes[0] >> 4, pawnsOnBothSides ? orderBytes[1] >> 4 : 0xF},
+            };
+            const uint8_t *pieceBytes = reader.take(pieces.size());
+            for(size_t side = 0; side < sideCount; side++)
+            {
+                PairsData &d = tableFile.pairs[side][file];
+                for(size_t i = 0; i < pieces.size(); i++)
+                    d.pieces[i] = (side == 0 ? pieceBytes[i] & 0xF : pieceBytes[i] >> 4);
+                vector<uint8_t> filePieces(d.pieces.begin(), d.pieces.begin() + pieces.size());
+                sort(filePieces.begin(), filePieces.end());
+                if(filePieces != expectedPieces || (hasPawns && ((d.pieces[0] & 7) != 1 || (size_t)count(filePieces.begin(), filePieces.end(), d.pieces[0]) != pawnCounts[0])))
+                    throw TablebaseFileError(fileName + " is corrupt");
+                setGroups(d, orders[side], file);
+            }
+        }
+        reader.align(2);
+        for(size_t file = 0; file < fileCount; file++)
+        {
+            for(size_t side = 0; side < sideCount; side++)
+                readSizes(reader, tableFile.pairs[side][file]);
+        }
+        if(distance)
+        {
+            tableFile.distanceMap = reader.current;
+            for(size_t file = 0; file < fileCount; file++)
+            {
+                PairsData &d = tableFile.pairs[0][file];
+                if(!(d.flags & mappedFlag))
+                    continue;
+                const size_t entrySize = (d.flags & wideFlag ? 2 : 1);
+                reader.align(entrySize);
+                for(size_t i = 0; i < d.mapIndexes.size(); i++)
+                {
+                    d.mapSizes[i] = (size_t)readLittleEndian(reader.take(entrySize), entrySize);
+                    d.mapIndexes[i] = (size_t)(reader.current - tableFile.distanceMap);
+                    reader.take(entrySize * d.mapSizes[i]);
+                }
+            }
+            reader.align(2);
+        }
+        for(size_t file = 0; file < fileCount; file++)
+        {
+            for(size_t side = 0; side < sideCount; side++)
+                tableFile.pairs[side][file].sparseIndex = reader.take(6 * tableFile.pairs[side][file].sparseIndexSize);
+        }
+        for(size_t file = 0; file < fileCount; file++)
+        {
+            for(size_t side = 0; side < sideCount; side++)
+                tableFile.pairs[side][file].blockLengths = reader.take(2 * tableFile.pairs[side][file].blockLengthCount);
+        }
+        for(size_t file = 0; file < fileCount; file++)
+        {
+            for(size_t side = 0; side < sideCount; side++)
+            {
+                PairsData &d = tableFile.pairs[side][file];
+                reader.align(64);
+                d.data = reader.take(d.blockCount * d.blockSize);
+            }
+        }
+    }
+};
+
+const char *const SyzygyTablebase::wdlFileExtension = ".rtbw";
+const char *const SyzygyTablebase::dtzFileExtension = ".rtbz";
+
+SyzygyTablebase::SyzygyTablebase()
+{
+}
+
+SyzygyTablebase::~SyzygyTablebase()
+{
+}
+
+void SyzygyTablebase::loadDirectory(const string &directory)
+{
+    DIR *dir = opendir(directory.c_str());
+    if(dir == nullptr)
+        throw TablebaseFileError("can't open " + directory + ": " + strerror(errno));
+    vector<string> signatures;
+    const string extension = wdlFileExtension;
+    while(dirent *entry = readdir(dir))
+    {
+        string name = entry->d_name;
+        if(name.size() > extension.size() && name.compare(name.size() - extension.size(), extension.size(), extension) == 0)
+            signatures.push_back(name.substr(0, name.size() - extension.size()));
+    }
+    closedir(dir);
+    for(const string &signature : signatures)
+    {
+        const string fileName = directory + "/" + signature + wdlFileExtension;
+        vector<PieceType> pieces;
+        if(!parseMaterialSignature(signature, pieces) || pieces.size() > MaxSyzygyPieceCount)
+            throw TablebaseFileError(fileName + " isn't named after a material");
+        unique_ptr<Table> table(new Table(signature, pieces));
+        table->load(table->wdl, fileName, false);
+        const string distanceFileName = directory + "/" + signature + dtzFileExtension;
+        if(access(distanceFileName.c_str(), F_OK) == 0)
+            table->load(table->dtz, distanceFileName, true);
+        maxPieceCount = max(maxPieceCount, pieces.size());
+        tablesBySignature[signature] = table.get();
+        tablesBySignature[getColorSwappedSignature(signature)] = table.get();
+        tables.push_back(std::move(table));
+    }
+}
+
+// looks gs up in its table without searching; for the distance tables wdl is gs's result, and the part of the
+// table for the other player to move gives ChangeSideToMove
+bool SyzygyTablebase::probeTable(const GameState &gs, bool distance, TablebaseWDL wdl, int &result, ProbeState &state) const
+{
+    if(getPieceCount(gs) == 2)
+    {
+        result = 0;
+        return true;
+    }
+    const string signature = getMaterialSignature(gs);
+    auto iter = tablesBySignature.find(signature);
+    if(iter == tablesBySignature.end())
+        return false;
+    const Table &table = *iter->second;
+    const TableFile &tableFile = (distance ? table.dtz : table.wdl);
+    if(!tableFile.file)
+        return false;
+    const EncodingTables &tables = getEncodingTables();
+    auto comparePawns = [&tables](int a, int b)
+    {
+        return tables.mapPawns[a] < tables.mapPawns[b];
+    };
+    // the tables are for the file's first side as white, and symmetric ones only have white to move, so other
+    // positions swap the colors and flip the board
+    const bool blackToMove = (gs.player == Player::Black);
+    const bool flip = (table.symmetric && blackToMove) || signature != table.signature;
+    const uint8_t colorFlip = (flip ? 8 : 0);
+    const int squareFlip = (flip ? 56 : 0);
+    const size_t sideToMove = (flip != blackToMove ? 1 : 0);
+    int squares[MaxSyzygyPieceCount];
+    uint8_t pieces[MaxSyzygyPieceCount];
+    size_t size = 0, leadPawnCount = 0, file = 0;
+    uint8_t leadPawn = 0;
+    // with pawns there's a part of the table for each file of the lead pawn, mirrored to a to d
+    if(table.hasPawns)
+    {
+        leadPawn = tableFile.pairs[0][0].pieces[0] ^ colorFlip;
+        for(int square = 0; square < squareCount; square++)
+        {
+            if(getSyzygyPiece(gs.board[getFile(square)][getRank(square)]) == leadPawn)
+                squares[size++] = square ^ squareFlip;
+        }
+        leadPawnCount = size;
+        swap(squares[0], *max_element(squares, squares + leadPawnCount, comparePawns));
+        file = (size_t)min(getFile(squares[0]), (int)BoardSize - 1 - getFile(squares[0]));
+    }
+    const PairsData &d = tableFile.pairs[distance ? 0 : sideToMove][file];
+    if(distance && (size_t)(d.flags & sideToMoveFlag) != sideToMove && !(table.symmetric && !table.hasPawns))
+    {
+        state = ProbeState::ChangeSideToMove;
+        return true;
+    }
+    for(int square = 0; square < squareCount; square++)
+    {
+        const uint8_t piece = getSyzygyPiece(gs.board[getFile(square)][getRank(square)]);
+        if(piece == 0 || (table.hasPawns && piece == leadPawn))
+            continue;
+        squares[size] = square ^ squareFlip;
+        pieces[size++] = piece ^ colorFlip;
+    }
+    assert(size == table.pieces.size());
+    for(size_t i = leadPawnCount; i + 1 < size; i++)
+    {
+        for(size_t j = i + 1; j < size; j++)
+        {
+            if(d.pieces[i] == pieces[j])
+            {
+                swap(pieces[i], pieces[j]);
+                swap(squares[i], squares[j]);
+                break;
+            }
+        }
+    }
+    if(getFile(squares[0]) >= (int)BoardSize / 2)
+    {
+        for(size_t i = 0; i < size; i++)
+            squares[i] ^= 7;
+    }
+    uint64_t index;
+    if(table.hasPawns)
+    {
+        index = tables.leadPawnIndexes[leadPawnCount][squares[0]];
+        stable_sort(squares + 1, squares + leadPawnCount, comparePawns);
+        for(size_t i = 1; i < leadPawnCount; i++)
+            index += tables.binomial[i][tables.mapPawns[squares[i]]];
+    }
+    else
+    {
+        // without pawns the first piece goes in the a1-d1-d4 triangle, and the first of the leading group off the
+        // diagonal below it
+        if(getRank(squares[0]) >= (int)BoardSize / 2)
+        {
+            for(size_t i = 0; i < size; i++)
+                squares[i] ^= 56;
+        }
+        for(int i = 0; i < d.groupLengths[0]; i++)
+        {
+            if(getDiagonalOffset(squares[i]) == 0)
+                continue;
+            if(getDiagonalOffset(squares[i]) > 0)
+            {
+                for(size_t j = i; j < size; j++)
+                    squares[j] = ((squares[j] >> 3) | (squares[j] << 3)) & 63;
+            }
+            break;
+        }
+        if(table.hasUniquePieces)
+        {
+            // the second piece skips the first's square and the third skips both
+            const int adjust1 = (squares[1] > squares[0]);
+            const int adjust2 = (squares[2] > squares[0]) + (squares[2] > squares[1]);
+            if(getDiagonalOffset(squares[0]) != 0)
+                index = ((uint64_t)tables.mapA1D1D4[squares[0]] * 63 + (squares[1] - adjust1)) * 62 + squares[2] - adjust2;
+            else if(getDiagonalOffset(squares[1]) != 0)
+                index = (uint64_t)(6 * 63 + getRank(squares[0]) * 28 + tables.mapB1H1H7[squares[1]]) * 62 + squares[2] - adjust2;
+            else if(getDiagonalOffset(squares[2]) != 0)
+                index = 6 * 63 * 62 + 4 * 28 * 62 + getRank(squares[0]) * 7 * 28 + (getRank(squares[1]) - adjust1) * 28 + tables.mapB1H1H7[squares[2]];
+            else
+                index = 6 * 63 * 62 + 4 * 28 * 62 + 4 * 7 * 28 + getRank(squares[0]) * 7 * 6 + (getRank(squares[1]) - adjust1) * 6 + (getRank(squares[2]) - adjust2);
+        }
+        else
+            index = tables.mapKK[tables.mapA1D1D4[squares[0]]][squares[1]];
+    }
+    index *= d.groupIndexes[0];
+    // each other group is a combination of the squares the groups before it left
+    int *groupSquares = squares + d.groupLengths[0];
+    bool remainingPawns = table.hasPawns && table.pawnCounts[1] != 0;
+    for(size_t next = 1; d.groupLengths[next] != 0; next++)
+    {
+        stable_sort(groupSquares, groupSquares + d.groupLengths[next]);
+        uint64_t groupIndex = 0;
+        for(int i = 0; i < d.groupLengths[next]; i++)
+        {
+            const int adjust = (int)count_if(squares, groupSquares, [&](int square)
+            {
+                return groupSquares[i] > square;
+            });
+            groupIndex += tables.binomial[i + 1][groupSquares[i] - adjust - (remainingPawns ? 8 : 0)];
+        }
+        remainingPawns = false;
+        index += groupIndex * d.groupIndexes[next];
+        groupSquares += d.groupLengths[next];
+    }
+    int value;
+    if(!d.decompress(index, value))
+        return false;
+    if(!distance)
+    {
+        if(value > 4)
+            return false;
+        result = value - 2;
+        return true;
+    }
+    // the values are numbered by how often they occur, separately for each result
+    if(d.flags & mappedFlag)
+    {
+        const size_t mapIndexes[5] = {1, 3, 0, 2, 0}; // by wdl, from a loss
+        const size_t map = mapIndexes[(int)wdl + 2];
+        if((size_t)value >= d.mapSizes[map])
+            return false;
+        if(d.flags & wideFlag)
+            value = (int)readLittleEndian(tableFile.distanceMap + d.mapIndexes[map] + 2 * value, 2);
+        else
+            value = tableFile.distanceMap[d.mapIndexes[map] + value];
+    }
+    if((wdl == TablebaseWDL::Win && !(d.flags & winPliesFlag)) || (wdl == TablebaseWDL::Loss && !(d.flags & lossPliesFlag))
+       || wdl == TablebaseWDL::CursedWin || wdl == TablebaseWDL::BlessedLoss)
+        value *= 2;
+    result = value + 1;
+    return true;
+}
+
+namespace
+{
+int getSign(int value)
+{
+    return (value > 0) - (value < 0);
+}
+
+bool isPawnMove(const GameState &gs, GameStateMove m)
+{
+    return gs.board[m.startX][m.startY] == PieceType::WhitePawn || gs.board[m.startX][m.startY] == PieceType::BlackPawn;
+}
+
+// the distance in plies for a position whose best move is a capture or pawn move
+int getDistanceBeforeZeroing(TablebaseWDL wdl)
+{
+    switch(wdl)
+    {
+    case TablebaseWDL::Loss:
+        return -1;
+    case TablebaseWDL::BlessedLoss:
+        return -101;
+    case TablebaseWDL::Draw:
+        return 0;
+    case TablebaseWDL::CursedWin:
+        return 101;
+    case TablebaseWDL::Win:
+        return 1;
+    }
+    assert(false);
+    return 0;
+}
+}
+
+// the tables may store anything for a position with a winning capture, and a loss for one with a drawing capture,
+// whatever compresses best; so the captures, and the pawn moves if checkZeroingMoves, are searched and the best of
+// them and the stored value is the result. state is ZeroingBestMove if one of those moves is the best
+TablebaseWDL SyzygyTablebase::search(const GameState &gs, bool checkZeroingMoves, ProbeState &state) const
+{
+    GameStateCache::MovesList moves;
+    GameStateCache::generateValidMoves(gs, moves);
+    TablebaseWDL bestValue = TablebaseWDL::Loss;
+    size_t moveCount = 0;
+    for(GameStateMove m : moves)
+    {
+        if(!m.isCapture(gs) && (!checkZeroingMoves || !isPawnMove(gs, m)))
+            continue;
+        moveCount++;
+        const TablebaseWDL value = -search(m.apply(gs), false, state);
+        if(state == ProbeState::Failed)
+            return TablebaseWDL::Draw;
+        if(value > bestValue)
+        {
+            bestValue = value;
+            if(value >= TablebaseWDL::Win)
+            {
+                state = ProbeState::ZeroingBestMove;
+                return value;
+            }
+        }
+    }
+    // the stored value is wrong if every move was searched, like when the only moves capture en passant
+    const bool noMoreMoves = (moveCount != 0 && moveCount == moves.size());
+    TablebaseWDL value = bestValue;
+    if(!noMoreMoves)
+    {
+        int storedValue;
+        if(!probeTable(gs, false, TablebaseWDL::Draw, storedValue, state))
+        {
+            state = ProbeState::Failed;
+            return TablebaseWDL::Draw;
+        }
+        value = (TablebaseWDL)storedValue;
+    }
+    if(bestValue >= value)
+    {
+        state = (bestValue > TablebaseWDL::Draw || noMoreMoves ? ProbeState::ZeroingBestMove : ProbeState::Ok);
+        return bestValue;
+    }
+    state = ProbeState::Ok;
+    return value;
+}
+
+// the plies to the next capture or pawn move along the best play, with 100 more for a cursed win or a blessed loss
+int SyzygyTablebase::probeDistance(const GameState &gs, ProbeState &state) const
+{
+    state = ProbeState::Ok;
+    const TablebaseWDL wdl = search(gs, true, state);
+    if(state == ProbeState::Failed || wdl == TablebaseWDL::Draw)
+        return 0;
+    // the distance tables don't store positions whose best move resets the count
+    if(state == ProbeState::ZeroingBestMove)
+        return getDistanceBeforeZeroing(wdl);
+    int distance;
+    if(!probeTable(gs, true, wdl, distance, state))
+    {
+        state = ProbeState::Failed;
+        return 0;
+    }
+    if(state != ProbeState::ChangeSideToMove)
+        return (distance + (wdl == TablebaseWDL::BlessedLoss || wdl == TablebaseWDL::CursedWin ? 100 : 0)) * getSign((int)wdl);
+    // only the other player to move is stored, so this takes the best of the moves
+    GameStateCache::MovesList moves;
+    GameStateCache::generateValidMoves(gs, moves);
+    int bestDistance = 0xFFFF;
+    for(GameStateMove m : moves)
+    {
+        const bool zeroing = m.isCapture(gs) || isPawnMove(gs, m);
+        const GameState childGs = m.apply(gs);
+        // a capture or pawn move is the first move of the distance, so it's scored by the result it leads to
+        int childDistance = (zeroing ? -getDistanceBeforeZeroing(search(childGs, false, state)) : -probeDistance(childGs, state));
+        if(state == ProbeState::Failed)
+            return 0;
+        if(childDistance == 1 && childGs.isKingAttacked())
+        {
+            GameStateCache::MovesList childMoves;
+            GameStateCache::generateValidMoves(childGs, childMoves);
+            if(childMoves.empty())
+                bestDistance = 1;
+        }
+        if(!zeroing)
+            childDistance += getSign(childDistance);
+        if(childDistance < bestDistance && getSign(childDistance) == getSign((int)wdl))
+            bestDistance = childDistance;
+    }
+    return bestDistance == 0xFFFF ? -1 : bestDistance;
+}
+
+bool SyzygyTablebase::probeWDL(const GameState &gs, TablebaseWDL &result) const
+{
+    if(!canProbe(gs))
+        return false;
+    ProbeState state = ProbeState::Ok;
+    result = search(gs, false, state);
+    return state != ProbeState::Failed;
+}
+
+bool SyzygyTablebase::probeDTZ(const GameState &gs, int &result) const
+{
+    if(!canProbe(gs))
+        return false;
+    GameStateCache::MovesList moves;
+    GameStateCache::generateValidMoves(gs, moves);
+    if(moves.empty())
+    {
+        result = 0;
+        return true;
+    }
+    ProbeState state = ProbeState::Ok;
+    result = probeDistance(gs, state);
+    return state != ProbeState::Failed;
+}
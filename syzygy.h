@@ -0,0 +1,48 @@
+#ifndef SYZYGY_H_INCLUDED
+#define SYZYGY_H_INCLUDED
+
+#include "tablebase.h"
+
+constexpr size_t MaxSyzygyPieceCount = 7;
+
+// Syzygy tables: a .rtbw file per material with the win/draw/loss of every position and an optional .rtbz file with
+// the distance to the next capture or pawn move, both memory-mapped. The files leave out positions with castling
+// rights or an en passant capture and may store anything for a position whose best move is a capture, so the
+// probes also search the captures down to the smaller tables
+class SyzygyTablebase final : public Tablebase
+{
+    struct Table;
+    enum class ProbeState : uint8_t
+    {
+        Ok,
+        Failed, // a table that's needed isn't loaded
+        ZeroingBestMove, // the best move is a capture or pawn move, so the distance table can't be trusted
+        ChangeSideToMove // the distance table only has the other player to move
+    };
+    vector<unique_ptr<Table>> tables;
+    unordered_map<string, const Table *> tablesBySignature; // by both the file's signature and its color-swapped version
+    size_t maxPieceCount = 0;
+    bool probeTable(const GameState &gs, bool distance, TablebaseWDL wdl, int &result, ProbeState &state) const;
+    TablebaseWDL search(const GameState &gs, bool checkZeroingMoves, ProbeState &state) const;
+    int probeDistance(const GameState &gs, ProbeState &state) const;
+public:
+    static const char *const wdlFileExtension;
+    static const char *const dtzFileExtension;
+    SyzygyTablebase();
+    SyzygyTablebase(const SyzygyTablebase &) = delete;
+    const SyzygyTablebase & operator =(const SyzygyTablebase &) = delete;
+    ~SyzygyTablebase();
+    void loadDirectory(const string &directory); // loads every .rtbw file in directory along with its .rtbz file if there is one
+    size_t getMaxPieceCount() const override
+    {
+        return maxPieceCount;
+    }
+    bool probeWDL(const GameState &gs, TablebaseWDL &result) const override;
+    bool probeDTZ(const GameState &gs, int &result) const override;
+    bool hasDistanceToMate() const override
+    {
+        return false;
+    }
+};
+
+#endif // SYZYGY_H_INCLUDED
@@ -0,0 +1,971 @@
+#include "tablebase.h"
+#include <dirent.h>
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+
+size_t getPieceCount(const GameState &gs)
+{
+    size_t retval = 0;
+    for(size_t piece = 1; piece < PieceTypeCount; piece++)
+        retval += gs.getPieceCount((PieceType)piece);
+    return retval;
+}
+
+bool hasCastlingRights(const GameState &gs)
+{
+    if(gs.whiteCanCastleLeft && gs.board[4][0] == PieceType::WhiteKing && gs.board[0][0] == PieceType::WhiteRook)
+        return true;
+    if(gs.whiteCanCastleRight && gs.board[4][0] == PieceType::WhiteKing && gs.board[7][0] == PieceType::WhiteRook)
+        return true;
+    if(gs.blackCanCastleLeft && gs.board[4][7] == PieceType::BlackKing && gs.board[0][7] == PieceType::BlackRook)
+        return true;
+    if(gs.blackCanCastleRight && gs.board[4][7] == PieceType::BlackKing && gs.board[7][7] == PieceType::BlackRook)
+        return true;
+    return false;
+}
+
+namespace
+{
+const char signatureLetters[] = "KQRBNP";
+const PieceType signaturePieces[] =
+{
+    PieceType::WhiteKing,
+    PieceType::WhiteQueen,
+    PieceType::WhiteRook,
+    PieceType::WhiteBishop,
+    PieceType::WhiteKnight,
+    PieceType::WhitePawn,
+};
+constexpr size_t signaturePieceCount = sizeof(signaturePieces) / sizeof(signaturePieces[0]);
+const char tableFileMagic[4] = {'C', 'T', 'B', '2'};
+constexpr size_t tableFileHeaderSize = sizeof(tableFileMagic) + 1 + MaxGeneratedTablebasePieceCount + 1 + 8;
+constexpr size_t tableFilePadding = 8; // so every entry can be read with one 8 byte load
+constexpr size_t squareCount = BoardSize * BoardSize;
+constexpr size_t NoTableIndex = SIZE_MAX;
+
+string makeMaterialSignature(const vector<PieceType> &pieces)
+{
+    string retval;
+    for(PieceColor color : {PieceColor::White, PieceColor::Black})
+    {
+        if(color == PieceColor::Black)
+            retval += 'v';
+        for(size_t i = 0; i < signaturePieceCount; i++)
+        {
+            for(PieceType piece : pieces)
+            {
+                if(piece == setPieceColor(signaturePieces[i], color))
+                    retval += signatureLetters[i];
+            }
+        }
+    }
+    return retval;
+}
+
+// only one of a material and its color-swapped version is generated: the one where white has more pieces, or
+// stronger ones when both sides have as many; probes of the other one swap the colors and mirror the board
+bool isGeneratedSignature(const string &signature)
+{
+    const size_t separator = signature.find('v');
+    const string white = signature.substr(0, separator), black = signature.substr(separator + 1);
+    if(white.size() != black.size())
+        return white.size() > black.size();
+    for(size_t i = 0; i < white.size(); i++)
+    {
+        if(white[i] != black[i])
+            return strchr(signatureLetters, white[i]) < strchr(signatureLetters, black[i]);
+    }
+    return true;
+}
+
+bool isTieByMaterial(const vector<PieceType> &pieces)
+{
+    GameState gs;
+    for(size_t i = 0; i < pieces.size(); i++)
+        gs.board[i % BoardSize][i / BoardSize] = pieces[i];
+    return gs.isTieByMaterial();
+}
+
+bool hasPawns(const vector<PieceType> &pieces)
+{
+    return find(pieces.begin(), pieces.end(), PieceType::WhitePawn) != pieces.end() || find(pieces.begin(), pieces.end(), PieceType::BlackPawn) != pieces.end();
+}
+
+size_t getBlackKingSlot(const vector<PieceType> &pieces)
+{
+    return find(pieces.begin(), pieces.end(), PieceType::BlackKing) - pieces.begin();
+}
+
+// a reflection of the board: bit 0 flips the files, bit 1 flips the ranks and bit 2 swaps files and ranks;
+// boards without pawns can use all of them, boards with pawns only the first two
+size_t getReflectedSquare(size_t square, size_t reflection)
+{
+    size_t x = square % BoardSize, y = square / BoardSize;
+    if(reflection & 1)
+        x = BoardSize - 1 - x;
+    if(reflection & 2)
+        y = BoardSize - 1 - y;
+    if(reflection & 4)
+        swap(x, y);
+    return y * BoardSize + x;
+}
+
+// the placements of the two kings that no reflection makes smaller, numbered in order: 462 without pawns,
+// 1806 with them
+struct KingPairs final
+{
+    vector<uint16_t> pairs; // white king square * 64 + black king square
+    int16_t numbers[squareCount * squareCount]; // -1 for the pairs not in pairs
+    uint8_t reflections[squareCount * squareCount]; // as bits, the ones that turn a pair into the smallest it can be
+    explicit KingPairs(size_t reflectionCount)
+    {
+        for(size_t pair = 0; pair < squareCount * squareCount; pair++)
+        {
+            numbers[pair] = -1;
+            reflections[pair] = 0;
+            const size_t whiteKing = pair / squareCount, blackKing = pair % squareCount;
+            const int dx = (int)(whiteKing % BoardSize) - (int)(blackKing % BoardSize), dy = (int)(whiteKing / BoardSize) - (int)(blackKing / BoardSize);
+            if(abs(dx) <= 1 && abs(dy) <= 1)
+                continue;
+            size_t smallestPair = pair;
+            for(size_t reflection = 0; reflection < reflectionCount; reflection++)
+                smallestPair = min(smallestPair, getReflectedSquare(whiteKing, reflection) * squareCount + getReflectedSquare(blackKing, reflection));
+            for(size_t reflection = 0; reflection < reflectionCount; reflection++)
+            {
+                if(getReflectedSquare(whiteKing, reflection) * squareCount + getReflectedSquare(blackKing, reflection) == smallestPair)
+                    reflections[pair] |= 1 << reflection;
+            }
+            if(smallestPair == pair)
+            {
+                numbers[pair] = (int16_t)pairs.size();
+                pairs.push_back((uint16_t)pair);
+            }
+        }
+    }
+};
+
+const KingPairs & getKingPairs(const vector<PieceType> &pieces)
+{
+    static const KingPairs withoutPawns(8), withPawns(2);
+    return hasPawns(pieces) ? withPawns : withoutPawns;
+}
+
+// index = player * the entries per side + the king pair's number * 64^(n - 2) + the squares of the other pieces as
+// base 64 digits, the first piece most significant; only one of the positions that reflections of the board turn
+// into each other has an index
+size_t getTableEntryCount(const vector<PieceType> &pieces)
+{
+    return getKingPairs(pieces).pairs.size() * 2 << (6 * (pieces.size() - 2));
+}
+
+void getSquare(size_t square, size_t &x, size_t &y)
+{
+    x = square % BoardSize;
+    y = square / BoardSize;
+}
+
+// returns false if the index doesn't describe a placement of the pieces; positions that aren't the one a
+// reflection covers still come out, and getTableIndex tells them apart
+bool makeTablePosition(const vector<PieceType> &pieces, size_t index, GameState &gs, size_t *squares)
+{
+    const size_t otherBits = 6 * (pieces.size() - 2);
+    const size_t sideEntryCount = getTableEntryCount(pieces) / 2;
+    const size_t blackKingSlot = getBlackKingSlot(pieces);
+    gs = GameState();
+    gs.blackCanCastleLeft = false;
+    gs.blackCanCastleRight = false;
+    gs.whiteCanCastleLeft = false;
+    gs.whiteCanCastleRight = false;
+    gs.player = (index >= sideEntryCount ? Player::Black : Player::White);
+    index %= sideEntryCount;
+    const size_t kingPair = getKingPairs(pieces).pairs[index >> otherBits];
+    for(size_t slot = 0, otherSlot = 0; slot < pieces.size(); slot++)
+    {
+        if(slot == 0)
+            squares[slot] = kingPair / squareCount;
+        else if(slot == blackKingSlot)
+            squares[slot] = kingPair % squareCount;
+        else
+            squares[slot] = index >> (otherBits - 6 * ++otherSlot) & (squareCount - 1);
+        size_t x, y;
+        getSquare(squares[slot], x, y);
+        if(gs.board[x][y] != PieceType::Empty)
+            return false;
+        if((pieces[slot] == PieceType::WhitePawn || pieces[slot] == PieceType::BlackPawn) && (y == 0 || y == BoardSize - 1))
+            return false;
+        gs.board[x][y] = pieces[slot];
+    }
+    gs.recalculateMaterial();
+    return true;
+}
+
+// the index of gs, which must hold the table's pieces, or NoTableIndex if the kings touch; of the reflections that
+// make the king pair smallest, the one that gives the smallest index is used so reflected positions share it
+size_t getTableIndex(const vector<PieceType> &pieces, const GameState &gs)
+{
+    const KingPairs &kingPairs = getKingPairs(pieces);
+    const size_t blackKingSlot = getBlackKingSlot(pieces);
+    size_t squares[MaxGeneratedTablebasePieceCount];
+    bool found[MaxGeneratedTablebasePieceCount] = {};
+    for(size_t square = 0; square < squareCount; square++)
+    {
+        const PieceType piece = gs.board[square % BoardSize][square / BoardSize];
+        if(piece == PieceType::Empty)
+            continue;
+        size_t slot = 0;
+        while(slot < pieces.size() && (found[slot] || pieces[slot] != piece))
+            slot++;
+        assert(slot < pieces.size());
+        squares[slot] = square;
+        found[slot] = true;
+    }
+    const size_t kingPair = squares[0] * squareCount + squares[blackKingSlot];
+    if(kingPairs.reflections[kingPair] == 0)
+        return NoTableIndex;
+    size_t retval = SIZE_MAX;
+    for(size_t reflection = 0; reflection < 8; reflection++)
+    {
+        if(!(kingPairs.reflections[kingPair] & (1 << reflection)))
+            continue;
+        size_t reflectedSquares[MaxGeneratedTablebasePieceCount] = {};
+        for(size_t slot = 0; slot < pieces.size(); slot++)
+            reflectedSquares[slot] = getReflectedSquare(squares[slot], reflection);
+        // like pieces stay in board order
+        for(size_t slot = 1; slot < pieces.size(); slot++)
+        {
+            for(size_t previousSlot = slot; previousSlot > 0 && pieces[previousSlot - 1] == pieces[previousSlot] && reflectedSquares[previousSlot - 1] > reflectedSquares[previousSlot]; previousSlot--)
+                swap(reflectedSquares[previousSlot - 1], reflectedSquares[previousSlot]);
+        }
+        size_t index = (size_t)kingPairs.numbers[reflectedSquares[0] * squareCount + reflectedSquares[blackKingSlot]];
+        for(size_t slot = 1; slot < pieces.size(); slot++)
+        {
+            if(slot != blackKingSlot)
+                index = index * squareCount + reflectedSquares[slot];
+        }
+        retval = min(retval, index);
+    }
+    return (gs.player == Player::Black ? getTableEntryCount(pieces) / 2 : 0) + retval;
+}
+
+struct Direction final
+{
+    int dx, dy;
+};
+
+const Direction kingDirections[] = {{1, 0}, {1, 1}, {0, 1}, {-1, 1}, {-1, 0}, {-1, -1}, {0, -1}, {1, -1}};
+const Direction rookDirections[] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
+const Direction bishopDirections[] = {{1, 1}, {-1, 1}, {-1, -1}, {1, -1}};
+const Direction knightJumps[] = {{1, 2}, {2, 1}, {2, -1}, {1, -2}, {-1, -2}, {-2, -1}, {-2, 1}, {-1, 2}};
+
+bool isEmptySquare(const GameState &gs, int x, int y)
+{
+    return x >= 0 && y >= 0 && x < (int)BoardSize && y < (int)BoardSize && gs.board[x][y] == PieceType::Empty;
+}
+
+// calls fn(slot, fromSquare) for every move by the player that isn't to move in gs that could have led to gs
+// without capturing or promoting; the player that moved couldn't have been in check afterwards since gs is valid
+template <typename Fn>
+void forEachQuietUnmove(const GameState &gs, const vector<PieceType> &pieces, const size_t *squares, Fn fn)
+{
+    const PieceColor moverColor = getPieceColor(getOpponent(gs.player));
+    for(size_t slot = 0; slot < pieces.size(); slot++)
+    {
+        const PieceType piece = pieces[slot];
+        if(getPieceColor(piece) != moverColor)
+            continue;
+        size_t x, y;
+        getSquare(squares[slot], x, y);
+        auto addSliding = [&](const Direction *directions, size_t directionCount)
+        {
+            for(size_t i = 0; i < directionCount; i++)
+            {
+                for(int fromX = (int)x + directions[i].dx, fromY = (int)y + directions[i].dy; isEmptySquare(gs, fromX, fromY); fromX += directions[i].dx, fromY += directions[i].dy)
+                    fn(slot, getSquareIndex(fromX, fromY));
+            }
+        };
+        auto addSteps = [&](const Direction *directions, size_t directionCount)
+        {
+            for(size_t i = 0; i < directionCount; i++)
+            {
+                int fromX = (int)x + directions[i].dx, fromY = (int)y + directions[i].dy;
+                if(isEmptySquare(gs, fromX, fromY))
+                    fn(slot, getSquareIndex(fromX, fromY));
+            }
+        };
+        switch(piece)
+        {
+        case PieceType::WhiteKing:
+        case PieceType::BlackKing:
+            addSteps(kingDirections, 8);
+            break;
+        case PieceType::WhiteKnight:
+        case PieceType::BlackKnight:
+            addSteps(knightJumps, 8);
+            break;
+        case PieceType::WhiteRook:
+        case PieceType::BlackRook:
+            addSliding(rookDirections, 4);
+            break;
+        case PieceType::WhiteBishop:
+        case PieceType::BlackBishop:
+            addSliding(bishopDirections, 4);
+            break;
+        case PieceType::WhiteQueen:
+        case PieceType::BlackQueen:
+            addSliding(kingDirections, 8);
+            break;
+        case PieceType::WhitePawn:
+            if(y >= 2 && isEmptySquare(gs, x, y - 1))
+            {
+                fn(slot, getSquareIndex(x, y - 1));
+                if(y == 3 && isEmptySquare(gs, x, 1))
+                    fn(slot, getSquareIndex(x, 1));
+            }
+            break;
+        case PieceType::BlackPawn:
+            if(y + 2 < BoardSize && isEmptySquare(gs, x, y + 1))
+            {
+                fn(slot, getSquareIndex(x, y + 1));
+                if(y == BoardSize - 4 && isEmptySquare(gs, x, BoardSize - 2))
+                    fn(slot, getSquareIndex(x, BoardSize - 2));
+            }
+            break;
+        case PieceType::Empty:
+            break;
+        }
+    }
+}
+
+uint64_t readLittleEndian(const uint8_t *bytes, size_t byteCount)
+{
+    uint64_t retval = 0;
+    for(size_t i = 0; i < byteCount; i++)
+        retval |= (uint64_t)bytes[i] << (8 * i);
+    return retval;
+}
+
+void writeLittleEndian(uint8_t *bytes, uint64_t value, size_t byteCount)
+{
+    for(size_t i = 0; i < byteCount; i++)
+        bytes[i] = (uint8_t)(value >> (8 * i));
+}
+
+// runs fn(begin, end, threadIndex) over [0, count) in chunks on threadCount threads; the first exception thrown stops
+// the other threads from taking more chunks and is rethrown once they're done
+template <typename Fn>
+void parallelFor(size_t count, size_t threadCount, Fn fn)
+{
+    const size_t chunkSize = 4096;
+    atomic<size_t> nextChunk(0);
+    mutex errorLock;
+    exception_ptr error;
+    auto worker = [&](size_t threadIndex)
+    {
+        try
+        {
+            for(;;)
+            {
+                size_t begin = nextChunk.fetch_add(chunkSize);
+                if(begin >= count)
+                    break;
+                fn(begin, min(count, begin + chunkSize), threadIndex);
+            }
+        }
+        catch(...)
+        {
+            nextChunk = count;
+            lock_guard<mutex> lock(errorLock);
+            if(!error)
+                error = current_exception();
+        }
+    };
+    vector<thread> threads;
+    for(size_t i = 1; i < threadCount; i++)
+        threads.push_back(thread(worker, i));
+    worker(0);
+    for(thread &t : threads)
+        t.join();
+    if(error)
+        rethrow_exception(error);
+}
+
+enum EntryState : uint8_t
+{
+    Unknown,
+    Won,
+    Lost,
+    Drawn,
+    Invalid
+};
+
+constexpr uint8_t NoDistance = 0xFF; // as a loss distance it also means a capture or promotion draws
+constexpr uint8_t MaxDistance = 0xFE;
+
+typedef vector<vector<uint32_t>> Buckets; // positions to settle, by distance to mate
+
+void addToBucket(Buckets &buckets, size_t distance, size_t index)
+{
+    if(distance > MaxDistance)
+        throw runtime_error("tablebase distance to mate is too long");
+    buckets[distance].push_back((uint32_t)index);
+}
+
+void mergeBuckets(Buckets &destination, vector<Buckets> &sources)
+{
+    for(Buckets &source : sources)
+    {
+        for(size_t distance = 0; distance < source.size(); distance++)
+        {
+            destination[distance].insert(destination[distance].end(), source[distance].begin(), source[distance].end());
+            source[distance].clear();
+        }
+    }
+}
+
+bool isEnpassantCapture(const GameState &gs, GameStateMove m)
+{
+    return gs.enpassantCaptureY != 0 && m.endX == gs.enpassantCaptureX && m.endY == gs.enpassantCaptureY && gs.board[m.startX][m.startY] == setPieceColor(PieceType::WhitePawn, gs.player);
+}
+
+// positive distances win, so a shorter one is better; negative ones lose, so a longer one is better
+bool isBetterDistance(int distance, int otherDistance)
+{
+    if((distance > 0) != (otherDistance > 0))
+        return distance > 0;
+    if(distance > 0)
+        return distance < otherDistance;
+    return distance < otherDistance || (distance == 0 && otherDistance < 0);
+}
+
+// finds the best en passant capture in gs for the player to move, as plies to mate that are positive when winning,
+// negative when losing and 0 for a draw; otherMoves is set if there are legal moves besides the en passant captures
+bool probeEnpassantCaptures(const GameState &gs, const GeneratedTablebase &tables, int &result, bool &otherMoves)
+{
+    GameStateCache::MovesList moves;
+    GameStateCache::generateValidMoves(gs, moves);
+    bool found = false;
+    otherMoves = false;
+    for(GameStateMove m : moves)
+    {
+        if(!isEnpassantCapture(gs, m))
+        {
+            otherMoves = true;
+            continue;
+        }
+        const GameState childGs = m.apply(gs);
+        TablebaseWDL childWDL = TablebaseWDL::Draw;
+        int childDistance = 0;
+        if(!childGs.isTieByMaterial() && !(tables.probeWDL(childGs, childWDL) && tables.probeDTZ(childGs, childDistance)))
+            throw runtime_error("missing tablebase " + getMaterialSignature(childGs));
+        int distance = 0;
+        if(childWDL == TablebaseWDL::Loss)
+            distance = 1 - childDistance;
+        else if(childWDL != TablebaseWDL::Draw)
+            distance = -1 - childDistance;
+        if(!found || isBetterDistance(distance, result))
+            result = distance;
+        found = true;
+    }
+    return found;
+}
+
+// a double push that lets the opponent capture en passant leads to a position the table has no entry for: its
+// value is the better of the en passant captures and the entry without the right. At most one pawn per side fits
+// in the tables, so a position has at most one such move
+enum EnpassantState : uint8_t
+{
+    NoEnpassantMove,
+    EnpassantMovePending,
+    EnpassantMoveSettled
+};
+
+// retrograde analysis: settles mates first, then every position one ply further out, walking backwards with unmoves
+void generateTable(const vector<PieceType> &pieces, const string &fileName, const GeneratedTablebase &tables, size_t threadCount, ostream *log)
+{
+    const size_t entryCount = getTableEntryCount(pieces);
+    unique_ptr<atomic<uint8_t>[]> states(new atomic<uint8_t>[entryCount]);
+    unique_ptr<atomic<uint8_t>[]> winDistances(new atomic<uint8_t>[entryCount]);
+    unique_ptr<atomic<uint8_t>[]> remainingMoveCounts(new atomic<uint8_t>[entryCount]); // moves that stay in this table not known to lose
+    unique_ptr<atomic<uint8_t>[]> lossDistances(new atomic<uint8_t>[entryCount]);
+    unique_ptr<atomic<uint8_t>[]> enpassantStates;
+    if(find(pieces.begin(), pieces.end(), PieceType::WhitePawn) != pieces.end() && find(pieces.begin(), pieces.end(), PieceType::BlackPawn) != pieces.end())
+        enpassantStates.reset(new atomic<uint8_t>[entryCount]);
+    Buckets buckets(MaxDistance + 1);
+    Buckets enpassantDeadlines(MaxDistance + 1); // pending en passant moves by when the capture wins for the opponent
+    vector<Buckets> threadBuckets(threadCount, Buckets(MaxDistance + 1));
+    vector<Buckets> threadEnpassantDeadlines(threadCount, Buckets(MaxDistance + 1));
+    auto addWinningMove = [&](size_t index, size_t distance, Buckets &bucketsToAdd)
+    {
+        uint8_t oldDistance = winDistances[index];
+        while(oldDistance > distance)
+        {
+            if(winDistances[index].compare_exchange_weak(oldDistance, (uint8_t)distance))
+            {
+                addToBucket(bucketsToAdd, distance, index);
+                break;
+            }
+        }
+    };
+    // a move that stays in the table turned out to lose in distance plies, or to draw if distance is NoDistance
+    auto settleRemainingMove = [&](size_t index, size_t distance, Buckets &bucketsToAdd)
+    {
+        uint8_t oldDistance = lossDistances[index];
+        while(oldDistance < distance && !lossDistances[index].compare_exchange_weak(oldDistance, (uint8_t)distance))
+        {
+        }
+        if(remainingMoveCounts[index].fetch_sub(1) == 1 && lossDistances[index] != NoDistance && winDistances[index] == NoDistance)
+            addToBucket(bucketsToAdd, lossDistances[index], index);
+    };
+    // the positions that end the game and the moves that leave the table are looked up first
+    parallelFor(entryCount, threadCount, [&](size_t begin, size_t end, size_t threadIndex)
+    {
+        GameStateCache::MovesList moves;
+        vector<size_t> quietChildren; // reflections of one position are one move
+        size_t squares[MaxGeneratedTablebasePieceCount];
+        for(size_t index = begin; index < end; index++)
+        {
+            winDistances[index] = NoDistance;
+            remainingMoveCounts[index] = 0;
+            lossDistances[index] = 0;
+            if(enpassantStates)
+                enpassantStates[index] = NoEnpassantMove;
+            GameState gs;
+            if(!makeTablePosition(pieces, index, gs, squares) || gs.isKingAttacked(getOpponent(gs.player)) || getTableIndex(pieces, gs) != index)
+            {
+                states[index] = Invalid;
+                continue;
+            }
+            states[index] = Unknown;
+            if(gs.isTieByMaterial())
+            {
+                states[index] = Drawn;
+                continue;
+            }
+            moves.clear();
+            GameStateCache::generateValidMoves(gs, moves);
+            if(moves.empty())
+            {
+                if(gs.isKingAttacked())
+                    addToBucket(threadBuckets[threadIndex], 0, index);
+                else
+                    states[index] = Drawn;
+                continue;
+            }
+            size_t quietMoveCount = 0;
+            quietChildren.clear();
+            size_t bestWinDistance = NoDistance;
+            size_t worstLossDistance = 0;
+            bool canDraw = false;
+            for(GameStateMove m : moves)
+            {
+                const GameState childGs = m.apply(gs);
+                TablebaseWDL childWDL = TablebaseWDL::Draw;
+                int childDistance = 0;
+                int enpassantDistance = 0;
+                bool otherMoves = false;
+                if(enpassantStates && childGs.canCaptureEnpassant() && probeEnpassantCaptures(childGs, tables, enpassantDistance, otherMoves))
+                {
+                    if(otherMoves)
+                    {
+                        // settled along with the child's entry, or once the capture's win is certain
+                        assert(enpassantStates[index] == NoEnpassantMove);
+                        enpassantStates[index] = EnpassantMovePending;
+                        if(enpassantDistance > 0)
+                            addToBucket(threadEnpassantDeadlines[threadIndex], enpassantDistance, index);
+                        quietMoveCount++;
+                        continue;
+                    }
+                    // the en passant captures are the only moves, so they're the whole value
+                    childWDL = (enpassantDistance > 0 ? TablebaseWDL::Win : enpassantDistance < 0 ? TablebaseWDL::Loss : TablebaseWDL::Draw);
+                    childDistance = enpassantDistance;
+                }
+                else if(!m.isCapture(gs) && m.promoteToType == PieceType::Empty)
+                {
+                    quietChildren.push_back(getTableIndex(pieces, childGs));
+                    continue;
+                }
+                else if(!childGs.isTieByMaterial() && !(tables.probeWDL(childGs, childWDL) && tables.probeDTZ(childGs, childDistance)))
+                    throw runtime_error("missing tablebase " + getMaterialSignature(childGs));
+                if(childWDL == TablebaseWDL::Draw)
+                    canDraw = true;
+                else if(childWDL == TablebaseWDL::Loss)
+                    bestWinDistance = min<size_t>(bestWinDistance, 1 - childDistance);
+                else
+                    worstLossDistance = max<size_t>(worstLossDistance, 1 + childDistance);
+            }
+            sort(quietChildren.begin(), quietChildren.end());
+            quietMoveCount += unique(quietChildren.begin(), quietChildren.end()) - quietChildren.begin();
+            remainingMoveCounts[index] = (uint8_t)quietMoveCount;
+            if(bestWinDistance != NoDistance)
+            {
+                winDistances[index] = (uint8_t)bestWinDistance;
+                addToBucket(threadBuckets[threadIndex], bestWinDistance, index);
+            }
+            else if(canDraw)
+                lossDistances[index] = NoDistance;
+            else
+            {
+                if(worstLossDistance > MaxDistance)
+                    throw runtime_error("tablebase distance to mate is too long");
+                lossDistances[index] = (uint8_t)worstLossDistance;
+                if(quietMoveCount == 0)
+                    addToBucket(threadBuckets[threadIndex], worstLossDistance, index);
+            }
+        }
+    });
+    mergeBuckets(buckets, threadBuckets);
+    mergeBuckets(enpassantDeadlines, threadEnpassantDeadlines);
+    size_t maxDistance = 0;
+    for(size_t distance = 0; distance <= MaxDistance; distance++)
+    {
+        // a double push whose en passant capture wins for the opponent in distance plies loses now, unless the
+        // entry without the right settled it first
+        vector<uint32_t> deadlines;
+        deadlines.swap(enpassantDeadlines[distance]);
+        if(!deadlines.empty())
+        {
+            parallelFor(deadlines.size(), threadCount, [&](size_t begin, size_t end, size_t threadIndex)
+            {
+                for(size_t i = begin; i < end; i++)
+                {
+                    uint8_t expected = EnpassantMovePending;
+                    if(enpassantStates[deadlines[i]].compare_exchange_strong(expected, EnpassantMoveSettled) && states[deadlines[i]] == Unknown)
+                        settleRemainingMove(deadlines[i], distance + 1, threadBuckets[threadIndex]);
+                }
+            });
+            mergeBuckets(buckets, threadBuckets);
+        }
+        vector<uint32_t> bucket;
+        bucket.swap(buckets[distance]);
+        if(bucket.empty())
+            continue;
+        parallelFor(bucket.size(), threadCount, [&](size_t begin, size_t end, size_t threadIndex)
+        {
+            size_t squares[MaxGeneratedTablebasePieceCount];
+            vector<pair<size_t, pair<size_t, size_t>>> unmoves; // previous index, slot and square moved from
+            for(size_t i = begin; i < end; i++)
+            {
+                const size_t index = bucket[i];
+                uint8_t state;
+                if(winDistances[index] == distance)
+                    state = Won;
+                else if(winDistances[index] == NoDistance && remainingMoveCounts[index] == 0 && lossDistances[index] == distance)
+                    state = Lost;
+                else
+                    continue;
+                uint8_t expected = Unknown;
+                if(!states[index].compare_exchange_strong(expected, state))
+                    continue; // already settled, possibly by a duplicate entry
+                GameState gs;
+                makeTablePosition(pieces, index, gs, squares);
+                unmoves.clear();
+                forEachQuietUnmove(gs, pieces, squares, [&](size_t slot, size_t fromSquare)
+                {
+                    GameState previousGs = gs;
+                    size_t x, y;
+                    getSquare(squares[slot], x, y);
+                    previousGs.board[x][y] = PieceType::Empty;
+                    getSquare(fromSquare, x, y);
+                    previousGs.board[x][y] = pieces[slot];
+                    previousGs.player = getOpponent(gs.player);
+                    const size_t previousIndex = getTableIndex(pieces, previousGs);
+                    if(previousIndex != NoTableIndex)
+                        unmoves.push_back(make_pair(previousIndex, make_pair(slot, fromSquare)));
+                });
+                // the forward pass counted each previous position's move here once, however many reflections it has
+                sort(unmoves.begin(), unmoves.end());
+                for(size_t j = 0; j < unmoves.size(); j++)
+                {
+                    const size_t previousIndex = unmoves[j].first, slot = unmoves[j].second.first, fromSquare = unmoves[j].second.second;
+                    if((j > 0 && unmoves[j - 1].first == previousIndex) || states[previousIndex] != Unknown)
+                        continue;
+                    if(enpassantStates && enpassantStates[previousIndex] != NoEnpassantMove && (pieces[slot] == PieceType::WhitePawn || pieces[slot] == PieceType::BlackPawn)
+                       && (squares[slot] > fromSquare ? squares[slot] - fromSquare : fromSquare - squares[slot]) == 2 * BoardSize)
+                    {
+                        GameState enpassantGs = gs;
+                        getSquare(squares[slot], enpassantGs.enpassantCaptureX, enpassantGs.enpassantCaptureY);
+                        enpassantGs.enpassantCaptureY = (squares[slot] + fromSquare) / 2 / BoardSize;
+                        int enpassantDistance = 0;
+                        bool otherMoves;
+                        uint8_t expected = EnpassantMovePending;
+                        if(!probeEnpassantCaptures(enpassantGs, tables, enpassantDistance, otherMoves) || !enpassantStates[previousIndex].compare_exchange_strong(expected, EnpassantMoveSettled))
+                            continue;
+                        if(state == Won)
+                            settleRemainingMove(previousIndex, distance + 1, threadBuckets[threadIndex]);
+                        else if(enpassantDistance > 0)
+                            settleRemainingMove(previousIndex, enpassantDistance + 1, threadBuckets[threadIndex]);
+                        else if(enpassantDistance == 0)
+                            settleRemainingMove(previousIndex, NoDistance, threadBuckets[threadIndex]);
+                        else
+                            addWinningMove(previousIndex, max<size_t>(distance, -enpassantDistance) + 1, threadBuckets[threadIndex]);
+                    }
+                    else if(state == Lost)
+                        addWinningMove(previousIndex, distance + 1, threadBuckets[threadIndex]);
+                    else
+                        settleRemainingMove(previousIndex, distance + 1, threadBuckets[threadIndex]);
+                }
+            }
+        });
+        mergeBuckets(buckets, threadBuckets);
+        maxDistance = distance;
+    }
+    unsigned bitsPerEntry = 1;
+    while(((size_t)1 << bitsPerEntry) <= maxDistance + 1)
+        bitsPerEntry++;
+    vector<uint8_t> data(tableFileHeaderSize + (entryCount * bitsPerEntry + 7) / 8 + tableFilePadding, 0);
+    memcpy(&data[0], tableFileMagic, sizeof(tableFileMagic));
+    data[sizeof(tableFileMagic)] = (uint8_t)pieces.size();
+    for(size_t slot = 0; slot < pieces.size(); slot++)
+        data[sizeof(tableFileMagic) + 1 + slot] = (uint8_t)pieces[slot];
+    data[sizeof(tableFileMagic) + 1 + MaxGeneratedTablebasePieceCount] = (uint8_t)bitsPerEntry;
+    writeLittleEndian(&data[sizeof(tableFileMagic) + 2 + MaxGeneratedTablebasePieceCount], entryCount, 8);
+    size_t counts[Invalid + 1] = {};
+    for(size_t index = 0; index < entryCount; index++)
+    {
+        const uint8_t state = states[index];
+        uint64_t code = 0;
+        if(state == Won)
+            code = winDistances[index] + 1;
+        else if(state == Lost)
+            code = lossDistances[index] + 1;
+        if(state == Unknown)
+            counts[Drawn]++;
+        else
+            counts[state]++;
+        assert(code == 0 || (state == Lost) == (code % 2 == 1));
+        const size_t bitOffset = index * bitsPerEntry;
+        uint8_t *bytes = &data[tableFileHeaderSize + bitOffset / 8];
+        writeLittleEndian(bytes, readLittleEndian(bytes, 8) | code << (bitOffset % 8), 8);
+    }
+    ofstream os(fileName, ios::binary);
+    os.write((const char *)&data[0], data.size());
+    os.close();
+    if(!os)
+        throw TablebaseFileError("can't write " + fileName);
+    if(log)
+        *log << makeMaterialSignature(pieces) << ": " << counts[Won] << " won, " << counts[Lost] << " lost, " << counts[Drawn] << " drawn, longest mate " << maxDistance << " plies" << endl;
+}
+}
+
+struct GeneratedTablebase::Table final
+{
+    vector<PieceType> pieces;
+    unique_ptr<MappedFile> file;
+    unsigned bitsPerEntry;
+    size_t entryCount;
+    const uint8_t *entries;
+    unsigned getCode(size_t index) const
+    {
+        const size_t bitOffset = index * bitsPerEntry;
+        return (unsigned)(readLittleEndian(entries + bitOffset / 8, 8) >> (bitOffset % 8)) & ((1U << bitsPerEntry) - 1);
+    }
+};
+
+const char *const GeneratedTablebase::fileExtension = ".ctb";
+
+GeneratedTablebase::GeneratedTablebase()
+{
+}
+
+GeneratedTablebase::~GeneratedTablebase()
+{
+}
+
+void GeneratedTablebase::loadFile(const string &fileName)
+{
+    unique_ptr<Table> table(new Table);
+    table->file.reset(new MappedFile(fileName));
+    const uint8_t *data = table->file->getData();
+    const size_t size = table->file->getSize();
+    if(size < tableFileHeaderSize || memcmp(data, tableFileMagic, sizeof(tableFileMagic)) != 0)
+        throw TablebaseFileError(fileName + " isn't a tablebase file");
+    const size_t pieceCount = data[sizeof(tableFileMagic)];
+    if(pieceCount < 2 || pieceCount > MaxGeneratedTablebasePieceCount)
+        throw TablebaseFileError(fileName + " has an invalid piece count");
+    for(size_t slot = 0; slot < pieceCount; slot++)
+        table->pieces.push_back((PieceType)data[sizeof(tableFileMagic) + 1 + slot]);
+    table->bitsPerEntry = data[sizeof(tableFileMagic) + 1 + MaxGeneratedTablebasePieceCount];
+    table->entryCount = readLittleEndian(data + sizeof(tableFileMagic) + 2 + MaxGeneratedTablebasePieceCount, 8);
+    table->entries = data + tableFileHeaderSize;
+    vector<PieceType> parsedPieces;
+    const string signature = makeMaterialSignature(table->pieces);
+    if(!parseMaterialSignature(signature, parsedPieces) || parsedPieces != table->pieces || table->bitsPerEntry == 0 || table->bitsPerEntry > 8
+       || table->entryCount != getTableEntryCount(table->pieces) || size < tableFileHeaderSize + (table->entryCount * table->bitsPerEntry + 7) / 8 + tableFilePadding)
+        throw TablebaseFileError(fileName + " is corrupt");
+    maxPieceCount = max(maxPieceCount, pieceCount);
+    tables[signature] = std::move(table);
+}
+
+void GeneratedTablebase::loadDirectory(const string &directory)
+{
+    DIR *dir = opendir(directory.c_str());
+    if(dir == nullptr)
+        throw TablebaseFileError("can't open " + directory + ": " + strerror(errno));
+    vector<string> fileNames;
+    const string extension = fileExtension;
+    while(dirent *entry = readdir(dir))
+    {
+        string name = entry->d_name;
+        if(name.size() > extension.size() && name.compare(name.size() - extension.size(), extension.size(), extension) == 0)
+            fileNames.push_back(directory + "/" + name);
+    }
+    closedir(dir);
+    for(const string &fileName : fileNames)
+        loadFile(fileName);
+}
+
+bool GeneratedTablebase::hasTable(const string &signature) const
+{
+    return tables.count(signature) != 0 || tables.count(getColorSwappedSignature(signature)) != 0;
+}
+
+bool GeneratedTablebase::probeCode(const GameState &gs, unsigned &code) const
+{
+    if(gs.canCaptureEnpassant() || hasCastlingRights(gs))
+        return false;
+    const string signature = getMaterialSignature(gs);
+    auto iter = tables.find(signature);
+    const bool swapColors = (iter == tables.end());
+    if(swapColors)
+        iter = tables.find(getColorSwappedSignature(signature));
+    if(iter == tables.end())
+        return false;
+    const Table &table = *iter->second;
+    if(!swapColors)
+    {
+        code = table.getCode(getTableIndex(table.pieces, gs));
+        return true;
+    }
+    // the table's white pieces are looked for as black ones, with the ranks reversed
+    GameState swappedGs = gs;
+    for(size_t x = 0; x < BoardSize; x++)
+    {
+        for(size_t y = 0; y < BoardSize; y++)
+        {
+            const PieceType piece = gs.board[x][BoardSize - 1 - y];
+            swappedGs.board[x][y] = (piece == PieceType::Empty ? piece : setPieceColor(piece, getOpponent(getPieceColor(piece))));
+        }
+    }
+    swappedGs.player = getOpponent(gs.player);
+    code = table.getCode(getTableIndex(table.pieces, swappedGs));
+    return true;
+}
+
+bool GeneratedTablebase::probeWDL(const GameState &gs, TablebaseWDL &result) const
+{
+    unsigned code;
+    if(!probeCode(gs, code))
+        return false;
+    if(code == 0)
+        result = TablebaseWDL::Draw;
+    else
+        result = (code % 2 == 1 ? TablebaseWDL::Loss : TablebaseWDL::Win);
+    return true;
+}
+
+bool GeneratedTablebase::probeDTZ(const GameState &gs, int &result) const
+{
+    unsigned code;
+    if(!probeCode(gs, code))
+        return false;
+    if(code == 0)
+        result = 0;
+    else
+        result = (code % 2 == 1 ? -(int)(code - 1) : (int)(code - 1));
+    return true;
+}
+
+string getMaterialSignature(const GameState &gs)
+{
+    vector<PieceType> pieces;
+    for(const auto &column : gs.board)
+    {
+        for(PieceType piece : column)
+        {
+            if(piece != PieceType::Empty)
+                pieces.push_back(piece);
+        }
+    }
+    return makeMaterialSignature(pieces);
+}
+
+bool parseMaterialSignature(const string &signature, vector<PieceType> &pieces)
+{
+    pieces.clear();
+    size_t separator = signature.find('v');
+    if(separator == string::npos)
+        return false;
+    string sides[2] = {signature.substr(0, separator), signature.substr(separator + 1)};
+    for(size_t side = 0; side < 2; side++)
+    {
+        if(sides[side].empty() || sides[side][0] != 'K')
+            return false;
+        for(char letter : sides[side])
+        {
+            const char *found = strchr(signatureLetters, letter);
+            if(letter == '\0' || found == nullptr)
+                return false;
+            pieces.push_back(setPieceColor(signaturePieces[found - signatureLetters], side == 0 ? PieceColor::White : PieceColor::Black));
+        }
+    }
+    return makeMaterialSignature(pieces) == signature;
+}
+
+string getColorSwappedSignature(const string &signature)
+{
+    const size_t separator = signature.find('v');
+    return signature.substr(separator + 1) + "v" + signature.substr(0, separator);
+}
+
+void generateTablebase(const string &signature, const string &directory, GeneratedTablebase &tables, size_t threadCount, ostream *log)
+{
+    vector<PieceType> pieces;
+    if(!parseMaterialSignature(signature, pieces))
+        throw runtime_error("invalid material signature: " + signature);
+    if(pieces.size() > MaxGeneratedTablebasePieceCount)
+        throw runtime_error("too many pieces to generate a tablebase: " + signature);
+    if(tables.hasTable(signature))
+        return;
+    if(!isGeneratedSignature(signature))
+    {
+        generateTablebase(getColorSwappedSignature(signature), directory, tables, threadCount, log);
+        return;
+    }
+    // every material a capture or promotion can lead to
+    vector<vector<PieceType>> dependencies;
+    for(size_t slot = 0; slot < pieces.size(); slot++)
+    {
+        const PieceType piece = pieces[slot];
+        if(piece == PieceType::WhiteKing || piece == PieceType::BlackKing)
+            continue;
+        vector<PieceType> captured = pieces;
+        captured.erase(captured.begin() + slot);
+        dependencies.push_back(captured);
+        if(piece != PieceType::WhitePawn && piece != PieceType::BlackPawn)
+            continue;
+        for(PieceType promotion : {PieceType::WhiteQueen, PieceType::WhiteRook, PieceType::WhiteBishop, PieceType::WhiteKnight})
+        {
+            vector<PieceType> promoted = pieces;
+            promoted[slot] = setPieceColor(promotion, getPieceColor(piece));
+            dependencies.push_back(promoted);
+            for(size_t capturedSlot = 0; capturedSlot < pieces.size(); capturedSlot++)
+            {
+                const PieceType capturedPiece = pieces[capturedSlot];
+                if(getPieceColor(capturedPiece) == getPieceColor(piece) || capturedPiece == PieceType::WhiteKing || capturedPiece == PieceType::BlackKing)
+                    continue;
+                vector<PieceType> capturedAndPromoted = promoted;
+                capturedAndPromoted.erase(capturedAndPromoted.begin() + capturedSlot);
+                dependencies.push_back(capturedAndPromoted);
+            }
+        }
+    }
+    for(const vector<PieceType> &dependency : dependencies)
+    {
+        if(!isTieByMaterial(dependency))
+            generateTablebase(makeMaterialSignature(dependency), directory, tables, threadCount, log);
+    }
+    const string fileName = directory + "/" + signature + GeneratedTablebase::fileExtension;
+    generateTable(pieces, fileName, tables, max<size_t>(threadCount, 1), log);
+    tables.loadFile(fileName);
+}
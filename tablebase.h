@@ -0,0 +1,115 @@
+#ifndef TABLEBASE_H_INCLUDED
+#define TABLEBASE_H_INCLUDED
+
+#include "game_state.h"
+#include "mapped_file.h"
+
+// from the point of view of the player to move; cursed wins and blessed losses are drawn by the fifty-move rule
+enum class TablebaseWDL : int8_t
+{
+    Loss = -2,
+    BlessedLoss = -1,
+    Draw = 0,
+    CursedWin = 1,
+    Win = 2
+};
+
+inline TablebaseWDL operator -(TablebaseWDL wdl)
+{
+    return (TablebaseWDL)-(int)wdl;
+}
+
+// tablebase wins are scored below every mate and above every evaluation
+inline Score getTablebaseScore(TablebaseWDL wdl, size_t ply)
+{
+    switch(wdl)
+    {
+    case TablebaseWDL::Loss:
+        return -TablebaseWinScore + (Score)ply;
+    case TablebaseWDL::BlessedLoss:
+        return -1;
+    case TablebaseWDL::Draw:
+        return 0;
+    case TablebaseWDL::CursedWin:
+        return 1;
+    case TablebaseWDL::Win:
+        return TablebaseWinScore - (Score)ply;
+    }
+    assert(false);
+    return 0;
+}
+
+struct TablebaseFileError final : public FileError
+{
+    explicit TablebaseFileError(const string &msg)
+        : FileError(msg)
+    {
+    }
+};
+
+size_t getPieceCount(const GameState &gs); // kings included
+bool hasCastlingRights(const GameState &gs); // only counts rights whose king and rook are still in place
+
+class Tablebase
+{
+public:
+    virtual ~Tablebase() = default;
+    // the most pieces, kings included, of any position in the tables
+    virtual size_t getMaxPieceCount() const = 0;
+    // the probes return false if the position isn't in the tables
+    virtual bool probeWDL(const GameState &gs, TablebaseWDL &result) const = 0;
+    // a distance in plies that shrinks along the best play, negative when losing and 0 for a draw or when mated;
+    // the distance to mate if hasDistanceToMate, otherwise the distance to the next capture or pawn move
+    virtual bool probeDTZ(const GameState &gs, int &result) const = 0;
+    virtual bool hasDistanceToMate() const = 0;
+    bool canProbe(const GameState &gs) const
+    {
+        return getPieceCount(gs) <= getMaxPieceCount() && !hasCastlingRights(gs);
+    }
+};
+
+constexpr size_t MaxGeneratedTablebasePieceCount = 4;
+
+// like "KRvKP": the white pieces then the black ones, each starting with the king in the order KQRBNP
+string getMaterialSignature(const GameState &gs);
+// the pieces in signature order: the white ones then the black ones; returns false unless signature is in that order
+bool parseMaterialSignature(const string &signature, vector<PieceType> &pieces);
+string getColorSwappedSignature(const string &signature); // "KRvKP" becomes "KPvKR"
+
+// tables made by generateTablebase, one file per material signature holding the distance to mate of every
+// placement of the pieces with either side to move, up to reflections of the board; a table also answers for its
+// material with the colors swapped. Positions with castling rights or an en passant capture aren't covered,
+// though the double pushes that allow one are valued with the capture
+class GeneratedTablebase final : public Tablebase
+{
+    struct Table;
+    unordered_map<string, unique_ptr<Table>> tables;
+    size_t maxPieceCount = 0;
+    // the plies to mate plus one, odd when losing, or 0 for a draw
+    bool probeCode(const GameState &gs, unsigned &code) const;
+public:
+    static const char *const fileExtension;
+    GeneratedTablebase();
+    GeneratedTablebase(const GeneratedTablebase &) = delete;
+    const GeneratedTablebase & operator =(const GeneratedTablebase &) = delete;
+    ~GeneratedTablebase();
+    void loadFile(const string &fileName);
+    void loadDirectory(const string &directory); // loads every table file in directory
+    bool hasTable(const string &signature) const; // either signature or its color-swapped version
+    size_t getMaxPieceCount() const override
+    {
+        return maxPieceCount;
+    }
+    bool probeWDL(const GameState &gs, TablebaseWDL &result) const override;
+    bool probeDTZ(const GameState &gs, int &result) const override;
+    bool hasDistanceToMate() const override
+    {
+        return true;
+    }
+};
+
+// generates the table for signature and every smaller table it needs that isn't in tables yet,
+// writing them to directory and loading them into tables
+void generateTablebase(const string &signature, const string &directory, GeneratedTablebase &tables, size_t threadCount = 1, ostream *log = nullptr);
+
+#endif // TABLEBASE_H_INCLUDED
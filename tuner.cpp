@@ -0,0 +1,382 @@
+#include "tuner.h"
+#include "evaluation.h"
+#include "mapped_file.h"
+#include <fstream>
+#include <cmath>
+#include <iomanip>
+
+namespace
+{
+// a quiet position reduced to its evaluation, which is linear in the parameters apart from the remainder; the
+// coefficients don't change during tuning, so they're worked out once when loading
+struct TuningPosition final
+{
+    size_t firstCoefficient; // in TuningSet::coefficients
+    uint16_t coefficientCount;
+    TaperedScore remainder;
+    uint8_t phase;
+    uint8_t result; // white's, in half points
+};
+
+struct TuningSet final
+{
+    vector<TuningPosition> positions;
+    vector<EvaluationCoefficient> coefficients;
+};
+
+// appends a position evaluated as remainder plus the coefficients, with the ones for the same parameter added together
+void addPosition(TuningSet &set, vector<EvaluationCoefficient> &coefficients, TaperedScore remainder, int phase, uint8_t result)
+{
+    sort(coefficients.begin(), coefficients.end(), [](const EvaluationCoefficient &l, const EvaluationCoefficient &r)
+    {
+        return l.parameter < r.parameter;
+    });
+    TuningPosition position;
+    position.remainder = remainder;
+    position.firstCoefficient = set.coefficients.size();
+    for(const EvaluationCoefficient &coefficient : coefficients)
+    {
+        if(set.coefficients.size() > position.firstCoefficient && set.coefficients.back().parameter == coefficient.parameter)
+            set.coefficients.back().count += coefficient.count;
+        else
+            set.coefficients.push_back(coefficient);
+        if(set.coefficients.back().count == 0)
+            set.coefficients.pop_back();
+    }
+    position.coefficientCount = (uint16_t)(set.coefficients.size() - position.firstCoefficient);
+    position.phase = (uint8_t)phase;
+    position.result = result;
+    set.positions.push_back(position);
+}
+
+PieceType getFENPieceType(char letter)
+{
+    const PieceType piece = [letter]()
+    {
+        switch(tolower(letter))
+        {
+        case 'p':
+            return PieceType::WhitePawn;
+        case 'n':
+            return PieceType::WhiteKnight;
+        case 'b':
+            return PieceType::WhiteBishop;
+        case 'r':
+            return PieceType::WhiteRook;
+        case 'q':
+            return PieceType::WhiteQueen;
+        case 'k':
+            return PieceType::WhiteKing;
+        default:
+            return PieceType::Empty;
+        }
+    }();
+    if(piece == PieceType::Empty || isupper(letter))
+        return piece;
+    return setPieceColor(piece, PieceColor::Black);
+}
+
+// in half points for white
+bool parseResult(const string &line, uint8_t &result)
+{
+    if(line.find("1/2-1/2") != string::npos || line.find("[0.5]") != string::npos)
+        result = 1;
+    else if(line.find("1-0") != string::npos || line.find("[1.0]") != string::npos || line.find("[1]") != string::npos)
+        result = 2;
+    else if(line.find("0-1") != string::npos || line.find("[0.0]") != string::npos || line.find("[0]") != string::npos)
+        result = 0;
+    else
+        return false;
+    return true;
+}
+
+// runs fn(threadIndex, begin, end) over parts of 0 through count
+template <typename Fn>
+void runInParallel(size_t threadCount, size_t count, Fn fn)
+{
+    const size_t partSize = (count + threadCount - 1) / threadCount;
+    vector<thread> threads;
+    for(size_t i = 0; i < threadCount && i * partSize < count; i++)
+        threads.push_back(thread(fn, i, i * partSize, min((i + 1) * partSize, count)));
+    for(thread &t : threads)
+        t.join();
+}
+
+typedef vector<array<double, 2>> TuningParameters; // the middlegame and endgame values
+
+// the mean squared difference between the results and the scores mapped to expected results; gradient, if it isn't
+// null, gets the derivative by each parameter
+double getTuningError(const TuningSet &set, const TuningParameters &parameters, double scale, size_t threadCount, TuningParameters *gradient)
+{
+    const vector<TuningPosition> &positions = set.positions;
+    vector<double> errors(threadCount, 0);
+    vector<TuningParameters> gradients(gradient ? threadCount : 0, TuningParameters(parameters.size(), array<double, 2>{{0, 0}}));
+    runInParallel(threadCount, positions.size(), [&](size_t threadIndex, size_t begin, size_t end)
+    {
+        for(size_t i = begin; i < end; i++)
+        {
+            const TuningPosition &position = positions[i];
+            const EvaluationCoefficient *coefficients = set.coefficients.data() + position.firstCoefficient;
+            double middlegame = position.remainder.middlegame, endgame = position.remainder.endgame;
+            for(size_t j = 0; j < position.coefficientCount; j++)
+            {
+                middlegame += coefficients[j].count * parameters[coefficients[j].parameter][0];
+                endgame += coefficients[j].count * parameters[coefficients[j].parameter][1];
+            }
+            const double middlegameWeight = (double)position.phase / MaxGamePhase;
+            const double evaluation = middlegame * middlegameWeight + endgame * (1 - middlegameWeight);
+            const double expected = 1 / (1 + pow(10.0, -scale * evaluation / 400));
+            const double difference = expected - position.result / 2.0;
+            errors[threadIndex] += difference * difference;
+            if(!gradient)
+                continue;
+            const double slope = 2 * difference * expected * (1 - expected) * scale * log(10.0) / 400;
+            for(size_t j = 0; j < position.coefficientCount; j++)
+            {
+                gradients[threadIndex][coefficients[j].parameter][0] += slope * coefficients[j].count * middlegameWeight;
+                gradients[threadIndex][coefficients[j].parameter][1] += slope * coefficients[j].count * (1 - middlegameWeight);
+            }
+        }
+    });
+    double error = 0;
+    for(double threadError : errors)
+        error += threadError;
+    if(gradient)
+    {
+        gradient->assign(parameters.size(), array<double, 2>{{0, 0}});
+        for(const TuningParameters &threadGradient : gradients)
+        {
+            for(size_t i = 0; i < parameters.size(); i++)
+            {
+                (*gradient)[i][0] += threadGradient[i][0] / positions.size();
+                (*gradient)[i][1] += threadGradient[i][1] / positions.size();
+            }
+        }
+    }
+    return error / positions.size();
+}
+
+void writeTable(ostream &os, const vector<TaperedScore> &parameters, size_t offset, size_t phase)
+{
+    static const char *const kindNames[PieceKindCount] = {"pawn", "rook", "knight", "bishop", "queen", "king"};
+    for(size_t kind = 0; kind < PieceKindCount; kind++)
+    {
+        os << "    {{ // " << kindNames[kind] << "\n";
+        for(size_t row = 0; row < BoardSize; row++)
+        {
+            os << "       ";
+            for(size_t column = 0; column < BoardSize; column++)
+            {
+                const TaperedScore value = parameters[offset + kind * BoardSize * BoardSize + row * BoardSize + column];
+                os << " " << setw(3) << (phase == 0 ? value.middlegame : value.endgame) << ",";
+            }
+            os << "\n";
+        }
+        os << "    }},\n";
+    }
+}
+}
+
+bool parseFEN(const string &fen, GameState &result)
+{
+    istringstream is(fen);
+    string placement, player, castling, enpassant;
+    if(!(is >> placement >> player >> castling >> enpassant))
+        return false;
+    GameState gs;
+    size_t x = 0, y = BoardSize - 1;
+    for(char ch : placement)
+    {
+        if(ch == '/')
+        {
+            if(x != BoardSize || y == 0)
+                return false;
+            x = 0;
+            y--;
+        }
+        else if(ch >= '1' && ch <= '8')
+            x += (size_t)(ch - '0');
+        else if(getFENPieceType(ch) != PieceType::Empty && x < BoardSize)
+            gs.board[x++][y] = getFENPieceType(ch);
+        else
+            return false;
+        if(x > BoardSize)
+            return false;
+    }
+    if(x != BoardSize || y != 0)
+        return false;
+    if(player != "w" && player != "b")
+        return false;
+    gs.player = (player == "w" ? Player::White : Player::Black);
+    gs.whiteCanCastleRight = (castling.find('K') != string::npos);
+    gs.whiteCanCastleLeft = (castling.find('Q') != string::npos);
+    gs.blackCanCastleRight = (castling.find('k') != string::npos);
+    gs.blackCanCastleLeft = (castling.find('q') != string::npos);
+    if(enpassant != "-")
+    {
+        if(enpassant.size() != 2 || enpassant[0] < 'a' || enpassant[0] > 'h' || (enpassant[1] != '3' && enpassant[1] != '6'))
+            return false;
+        gs.enpassantCaptureX = (size_t)(enpassant[0] - 'a');
+        gs.enpassantCaptureY = (size_t)(enpassant[1] - '1');
+    }
+    gs.recalculateMaterial();
+    if(gs.getPieceCount(PieceType::WhiteKing) != 1 || gs.getPieceCount(PieceType::BlackKing) != 1 || gs.isKingAttacked(getOpponent(gs.player)))
+        return false;
+    result = gs;
+    return true;
+}
+
+vector<TaperedScore> tuneEvaluation(const vector<string> &epdFileNames, const TunerOptions &options)
+{
+    const size_t threadCount = max<size_t>(options.threadCount, 1);
+    const auto startTime = chrono::steady_clock::now();
+    auto getSeconds = [startTime]()
+    {
+        return chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+    };
+    // quiescence doesn't use the transposition table, so the caches only need a token one
+    vector<unique_ptr<GameStateCache>> caches;
+    for(size_t i = 0; i < threadCount; i++)
+        caches.push_back(unique_ptr<GameStateCache>(new GameStateCache(make_shared<TranspositionTable>(1), 100000)));
+    TuningSet set;
+    size_t lineCount = 0, skippedCount = 0;
+    vector<string> batch;
+    const vector<TaperedScore> currentParameters = getEvaluationParameters();
+    auto addBatch = [&]()
+    {
+        vector<TuningSet> threadSets(threadCount);
+        vector<size_t> threadSkippedCounts(threadCount, 0);
+        runInParallel(threadCount, batch.size(), [&](size_t threadIndex, size_t begin, size_t end)
+        {
+            GameStateCache &cache = *caches[threadIndex];
+            vector<EvaluationCoefficient> coefficients;
+            for(size_t i = begin; i < end; i++)
+            {
+                GameState gs, quietPosition;
+                uint8_t result;
+                if(!parseFEN(batch[i], gs) || !parseResult(batch[i], result))
+                {
+                    threadSkippedCounts[threadIndex]++;
+                    continue;
+                }
+                cache.getQuiescenceScore(gs, &quietPosition);
+                // mates, draws by material and the kpk bitbase aren't evaluated by the parameters
+                coefficients.clear();
+                const TaperedScore remainder = getEvaluationCoefficients(quietPosition, coefficients);
+                TaperedScore score = remainder;
+                for(const EvaluationCoefficient &coefficient : coefficients)
+                {
+                    const TaperedScore value = currentParameters[coefficient.parameter];
+                    score += TaperedScore{(int16_t)(value.middlegame * coefficient.count), (int16_t)(value.endgame * coefficient.count)};
+                }
+                const int evaluation = getTaperedValue(score, quietPosition.getGamePhase());
+                if(quietPosition.getStaticEvaluation(cache) != (quietPosition.player == Player::White ? evaluation : -evaluation))
+                {
+                    threadSkippedCounts[threadIndex]++;
+                    continue;
+                }
+                addPosition(threadSets[threadIndex], coefficients, remainder, quietPosition.getGamePhase(), result);
+            }
+        });
+        for(size_t i = 0; i < threadCount; i++)
+        {
+            for(TuningPosition position : threadSets[i].positions)
+            {
+                position.firstCoefficient += set.coefficients.size();
+                set.positions.push_back(position);
+            }
+            set.coefficients.insert(set.coefficients.end(), threadSets[i].coefficients.begin(), threadSets[i].coefficients.end());
+            skippedCount += threadSkippedCounts[i];
+        }
+        batch.clear();
+    };
+    for(const string &fileName : epdFileNames)
+    {
+        ifstream is(fileName);
+        if(!is)
+            throw FileError("can't open " + fileName);
+        string line;
+        while(getline(is, line))
+        {
+            if(line.find_first_not_of(" \t\r") == string::npos)
+                continue;
+            lineCount++;
+            batch.push_back(line);
+            if(batch.size() >= 65536)
+                addBatch();
+        }
+    }
+    addBatch();
+    caches.clear();
+    if(set.positions.empty())
+        throw runtime_error("no positions to tune with");
+    if(options.log)
+        *options.log << "loaded " << set.positions.size() << " quiet positions from " << lineCount << " lines, skipped " << skippedCount << " (" << getSeconds() << "s)" << endl;
+    TuningParameters parameters;
+    for(TaperedScore value : getEvaluationParameters())
+        parameters.push_back(array<double, 2>{{(double)value.middlegame, (double)value.endgame}});
+    // the scale that maps scores to results best is found first and kept, so the parameters stay in centipawns
+    double lowScale = 0.05, highScale = 5;
+    for(int i = 0; i < 40; i++)
+    {
+        const double third = (highScale - lowScale) / 3;
+        if(getTuningError(set, parameters, lowScale + third, threadCount, nullptr) < getTuningError(set, parameters, highScale - third, threadCount, nullptr))
+            highScale -= third;
+        else
+            lowScale += third;
+    }
+    const double scale = (lowScale + highScale) / 2;
+    if(options.log)
+        *options.log << "scale " << scale << ", error " << getTuningError(set, parameters, scale, threadCount, nullptr) << " (" << getSeconds() << "s)" << endl;
+    // adam: each parameter's step is scaled by its own gradient history
+    const double beta1 = 0.9, beta2 = 0.999, epsilon = 1e-8;
+    TuningParameters gradient, momentum(parameters.size(), array<double, 2>{{0, 0}}), velocity = momentum;
+    for(size_t epoch = 1; epoch <= options.epochCount; epoch++)
+    {
+        const double error = getTuningError(set, parameters, scale, threadCount, &gradient);
+        for(size_t i = 0; i < parameters.size(); i++)
+        {
+            for(size_t phase = 0; phase < 2; phase++)
+            {
+                momentum[i][phase] = beta1 * momentum[i][phase] + (1 - beta1) * gradient[i][phase];
+                velocity[i][phase] = beta2 * velocity[i][phase] + (1 - beta2) * gradient[i][phase] * gradient[i][phase];
+                const double correctedMomentum = momentum[i][phase] / (1 - pow(beta1, (double)epoch));
+                const double correctedVelocity = velocity[i][phase] / (1 - pow(beta2, (double)epoch));
+                parameters[i][phase] -= options.learningRate * correctedMomentum / (sqrt(correctedVelocity) + epsilon);
+            }
+        }
+        if(options.log && (epoch % 10 == 0 || epoch == 1 || epoch == options.epochCount))
+            *options.log << "epoch " << epoch << ", error " << error << " (" << getSeconds() << "s)" << endl;
+    }
+    vector<TaperedScore> retval;
+    for(const array<double, 2> &value : parameters)
+        retval.push_back(TaperedScore{(int16_t)lround(value[0]), (int16_t)lround(value[1])});
+    return retval;
+}
+
+void writeEvaluationParameters(ostream &os, const vector<TaperedScore> &parameters)
+{
+    static const char *const kindNames[PieceKindCount] = {"pawn", "rook", "knight", "bishop", "queen", "king"};
+    os << "const array<TaperedScore, PieceKindCount> pieceValues =\n{{\n";
+    for(size_t kind = 0; kind < PieceKindCount; kind++)
+    {
+        const TaperedScore value = parameters[PieceValueParameterOffset + kind];
+        os << "    {" << value.middlegame << ", " << value.endgame << "}, // " << kindNames[kind] << "\n";
+    }
+    os << "}};\n\n";
+    os << "const array<array<int16_t, BoardSize * BoardSize>, PieceKindCount> middlegamePieceSquareBonuses =\n{{\n";
+    writeTable(os, parameters, PieceSquareParameterOffset, 0);
+    os << "}};\n\n";
+    os << "const array<array<int16_t, BoardSize * BoardSize>, PieceKindCount> endgamePieceSquareBonuses =\n{{\n";
+    writeTable(os, parameters, PieceSquareParameterOffset, 1);
+    os << "}};\n\n";
+    os << "const array<TaperedScore, PieceKindCount> mobilityWeights = {{";
+    for(size_t kind = 0; kind < PieceKindCount; kind++)
+    {
+        const TaperedScore value = parameters[MobilityParameterOffset + kind];
+        os << (kind == 0 ? "" : ", ") << "{" << value.middlegame << ", " << value.endgame << "}";
+    }
+    os << "}};\n";
+    const TaperedScore shield = parameters[PawnShieldParameterOffset], advancedShield = parameters[PawnShieldParameterOffset + 1];
+    os << "const array<TaperedScore, 2> pawnShieldBonuses = {{{" << shield.middlegame << ", " << shield.endgame << "}, {" << advancedShield.middlegame << ", " << advancedShield.endgame << "}}};\n";
+}
@@ -0,0 +1,25 @@
+#ifndef TUNER_H_INCLUDED
+#define TUNER_H_INCLUDED
+
+#include "game_state.h"
+
+// reads a fen or epd position, ignoring anything after the en passant square
+bool parseFEN(const string &fen, GameState &result);
+
+struct TunerOptions final
+{
+    size_t threadCount = 1;
+    size_t epochCount = 300;
+    double learningRate = 1; // about how many centipawns a parameter moves per epoch
+    ostream *log = nullptr;
+};
+
+// fits the evaluation parameters to the game results of the positions in the epd files, each line ending with a
+// result such as c9 "1-0"; or [0.5]; each position is first replaced by the end of its quiescence search, so
+// the evaluation is only asked about quiet positions
+vector<TaperedScore> tuneEvaluation(const vector<string> &epdFileNames, const TunerOptions &options = TunerOptions());
+
+// the parameters in the form of the tables in the source they come from
+void writeEvaluationParameters(ostream &os, const vector<TaperedScore> &parameters);
+
+#endif // TUNER_H_INCLUDED